@@ -3,179 +3,1215 @@
 
 // This class parses phone calls and finds out the number with most acquaintances.
 //
-// Phone calls are stored in a hash table(HashCall calls). For each entry, the key is
-// the calling number, and the value is a hash table of called numbers(friends of the
-// calling number). The reason for storing friends in another hash table is that finding
-// an element in unordered_map costs constant time on average. 
+// Every phone number is interned once into a dense 32-bit ID(NumberPool): the
+// digits of all numbers are stored back to back in one buffer, and an open
+// addressing table maps a number to its ID. Calls are collected as pairs of IDs,
+// then frozen into an undirected graph in compressed sparse row form(CallGraph):
+// the friends of ID v are neighbors[offsets[v]..offsets[v+1]), sorted and without
+// duplicates, so checking a friendship is a binary search over contiguous memory.
+// Numbers with many friends(hubs) also get a bitmap of their friends, which tests
+// a friendship in O(1) and is not larger than their list.
+// Both can be saved to a snapshot file, which is mapped back into memory and used
+// in place, without parsing the log again.
 //
-// The acquaitances for each calling number is counted iteratively: given a calling 
-// number, go through all of its friends' friends. For calling number A, one of A's 
-// frind B and one of B's frind C, if C not in A's friend list and A is not in C's 
-// friend list, either, then A and C are acquaintances. All phone numbers and the 
-// corresponding numbers their acquaintances are stored in a hash table.
+// The acquaitances for each number are counted iteratively: given a number A,
+// go through all of its friends' friends. For A's friend B and one of B's friends C,
+// if C is not A and C is not A's friend, then A and C are acquaintances. Every
+// acquaintance is counted once, however many friends it shares with A: A and its
+// friends are stamped with A's mark in an array indexed by ID, and so is every
+// acquaintance when it is counted; or the bitmaps of the friends which are hubs
+// are or-ed together. The count of A is kept in an array indexed by A's ID.
+// Numbers are counted in parallel: worker threads take chunks of IDs from a shared
+// counter, each with its own stamps, and each count is written by the only thread
+// computing it. The top numbers are selected with a min-heap of k counts.
 //
-// Complexity - givn n calls:
-// The time complexity of reading call log is O(n), finding friendships & acquaintances
-// costs O(1) on average(but O(n^3) at the worst case, due to C++ unordered_map) and
-// finding the number with most acquaintances requires O(n). Therefore, on average the
-// time complexity is O(n).
-// The space complexity is also O(n), because each number is stored for 3 times at most.
+// For huge graphs the counts can be approximated with HyperLogLog sketches of the
+// numbers within two calls of A, merged from the sketches of the friends of A with
+// more friends than the sketch has registers. Counts cheaper to make exactly are
+// still exact.
+//
+// Complexity - given n calls between m numbers:
+// Reading the call log costs O(n) on average(hashing), divided by the threads plus
+// O(m) to merge their numbers, and freezing the graph O(n*log(d)) for the sorts of
+// the friend lists of degree d. Counting visits the friends of every pair of
+// friends: O(sum(d^2)) at most, divided by the threads, or O(m/64) per friend
+// which is a hub, and O(d*r) per number with sketches of r registers. Selecting
+// the top k numbers costs O(m*log(k)).
+// The space complexity is O(n+m): 8 bytes per call in the friend lists and at most
+// as much in the bitmaps, 16 bytes plus the digits per number, and 4 bytes of
+// stamps per number and thread. Sketches take at most 2 bytes per call.
 
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <string_view>
 #include <vector>
-#include <unordered_map>
-#include <queue>
 #include <algorithm>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <cstdio>
+#include <cerrno>
+#include <utility>
+#include <memory>
+#include <stdexcept>
 #include <functional>
-#include <cctype>
-#include <locale>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Elements in a vector of their own, or read-only in a mapped snapshot. They are
+// copied out of the snapshot when they are modified for the first time.
+template<typename T>
+class Array {
+public:
+	Array() {}
+	Array(size_t n, const T& value): own(n,value) {}
+
+	const T* data() const {return mapped ? mapped : own.data();}
+	size_t size() const {return mapped ? len : own.size();}
+	bool empty() const {return size()==0;}
+	const T& operator[](size_t i) const {return data()[i];}
+
+	std::vector<T>& Own() {	// the elements, to modify
+		if(mapped) {
+			own.assign(mapped,mapped+len);
+			mapped=NULL;
+		}
+		return own;
+	}
+	std::vector<T>& Reset() {	// no elements, to fill
+		mapped=NULL;
+		own.clear();
+		return own;
+	}
+	void Map(const T* elems, size_t n) {	// elems must outlive the array
+		std::vector<T>().swap(own);
+		mapped=elems;
+		len=n;
+	}
+
+private:
+	std::vector<T> own;
+	const T* mapped=NULL;
+	size_t len=0;
+};
 
-typedef std::unordered_map<std::string,std::unordered_map<std::string,bool> > HashCall;
-typedef std::unordered_map<std::string,int> HashAcq;
+// Phone numbers interned into dense IDs 0, 1, 2...
+class NumberPool {
+public:
+	static const uint32_t kNone=UINT32_MAX;
+
+	uint32_t Intern(std::string_view num);	// ID of num, added if new
+	uint32_t Find(std::string_view num) const;	// ID of num, kNone if unknown
+	std::string_view Name(uint32_t id) const {
+		return std::string_view(chars.data()+offsets[id],offsets[id+1]-offsets[id]);
+	}
+	uint32_t Size() const {return offsets.size()-1;}
+
+private:
+	friend class AcquaintsFinder;	// saves and maps the arrays
+
+	static uint64_t Hash(std::string_view num);	// FNV-1a
+	void Rehash(size_t nslots);
+
+	Array<char> chars;	// digits of all numbers, back to back
+	Array<uint64_t> offsets=Array<uint64_t>(1,0);	// number i is chars[offsets[i]..offsets[i+1])
+	Array<uint32_t> slots;	// open addressing table of ID+1, 0 if empty
+};
+
+// Undirected call graph in compressed sparse row form
+struct CallGraph {
+	static constexpr uint32_t kNoBitmap=UINT32_MAX;
+	static constexpr uint64_t kHubDegree=64;	// fewer friends are always kept in a list only
+
+	Array<uint64_t> offsets=Array<uint64_t>(1,0);	// friends of v: neighbors[offsets[v]..offsets[v+1])
+	Array<uint32_t> neighbors;	// sorted friend lists
+	Array<uint32_t> hubs;	// bitmap index of every node, kNoBitmap if none
+	Array<uint64_t> bitmaps;	// friends of hubs, words per bitmap
+	uint64_t words=0;
+
+	uint32_t Size() const {return offsets.size()-1;}
+	uint64_t Degree(uint32_t v) const {return offsets[v+1]-offsets[v];}
+	const uint32_t* begin(uint32_t v) const {return neighbors.data()+offsets[v];}
+	const uint32_t* end(uint32_t v) const {return neighbors.data()+offsets[v+1];}
+	bool Adjacent(uint32_t a, uint32_t b) const;
+	uint64_t CommonFriends(uint32_t a, uint32_t b) const;	// size of the intersection of friend lists
+	const uint64_t* Bitmap(uint32_t v) const {
+		return hubs[v]==kNoBitmap ? NULL : bitmaps.data()+hubs[v]*words;
+	}
+	static bool TestBit(const uint64_t* bits, uint32_t v) {return bits[v>>6]>>(v&63)&1;}
+	// size of the intersection of two sorted lists without duplicates
+	static uint64_t Intersect(const uint32_t* x, const uint32_t* xend, const uint32_t* y, const uint32_t* yend);
+
+	// Build from calls between nodes 0..n-1. Self calls and repeated calls are dropped.
+	void Build(uint32_t n, const std::vector<std::pair<uint32_t,uint32_t> >& calls);
+};
+
+// HyperLogLog sketches of sets of IDs, one byte per register
+struct HyperLogLog {
+	// Registers for a relative standard error of error: 1.04/sqrt(2^precision)
+	static unsigned Precision(double error);
+	static void Insert(uint8_t* regs, unsigned precision, uint32_t id);
+	static void Merge(uint8_t* regs, const uint8_t* other, unsigned precision);
+	static double Estimate(const uint8_t* regs, unsigned precision);
+};
 
 class AcquaintsFinder {
 public:
-	AcquaintsFinder(){}
-	AcquaintsFinder(std::string log){LoadCallLog(log);}
+	AcquaintsFinder(): overlay_calls(0), counted(false), ranked_k(0), threads(0), precision(0) {}
+	AcquaintsFinder(std::string log): overlay_calls(0), counted(false), ranked_k(0), threads(0), precision(0) {LoadCallLog(log);}
 	~AcquaintsFinder(){}
 
-	HashCall& LoadCallLog(std::string log);
-	bool IsFriend(std::string a, std::string b);	// determine if b is a friend of a
-	std::pair<std::string,int> FindMostAcquaint();	// find the one with most acquaints
+	size_t LoadCallLog(std::string log);	// returns the number of calls loaded
+	// Add one call. Once the acquaints are counted, only the counts of a, b and
+	// their friends are updated, visiting the friends of their friends.
+	void AddCall(std::string_view a, std::string_view b);
+	bool IsFriend(std::string_view a, std::string_view b);	// determine if b is a friend of a
+	typedef std::pair<std::string,uint64_t> NumberCount;	// <phone number, acquaints>
+	// Called with the top k so far, after counted of total numbers
+	typedef std::function<void(const std::vector<NumberCount>& top, uint32_t counted, uint32_t total)> TopProgress;
+
+	NumberCount FindMostAcquaint();	// find the one with most acquaints
+	// Find the k numbers with most acquaints, by descending count. Ties go to the
+	// number seen first in the logs.
+	std::vector<NumberCount> FindTopAcquaints(size_t k);
+	// Same, calling progress from the counting threads(one call at a time) at most
+	// every period while counting, and once with the final result
+	std::vector<NumberCount> FindTopAcquaints(size_t k, const TopProgress& progress,
+		std::chrono::milliseconds period=std::chrono::milliseconds(100));
+
+	// Binary snapshot of the numbers, the graph, and the counts if they are made.
+	// LoadSnapshot maps the file read-only: nothing is parsed, and the arrays are
+	// copied out of it only when they are modified. Both return false on failure;
+	// LoadSnapshot throws runtime_error if the arrays of the snapshot are corrupt.
+	bool SaveSnapshot(const std::string& path);
+	bool LoadSnapshot(const std::string& path);
+
+	uint32_t GetNumberCount() const {return numbers.Size();}
+	void SetThreads(unsigned n) {threads=n;}	// loading and counting threads, 0 for all cores
+	// Approximate the counts within a relative standard error, 0 for exact counts
+	void SetApproximate(double error);
 
 protected:
-	std::string& ltrim(std::string &s); // trim left spaces of a string
-	std::string& rtrim(std::string &s); // trim right spaces of a string
-	std::string& trim(std::string &s);  // trim spaces in a string
+	static std::string_view Trim(std::string_view s);	// trim spaces at both ends
+	static size_t ParseCalls(const char* first, const char* last, NumberPool& pool,
+		std::vector<std::pair<uint32_t,uint32_t> >& calls, std::vector<std::string_view>& invalid);
+	// Marks of the numbers seen while counting, by one thread
+	struct Stamps {
+		std::vector<uint32_t> seen;	// the mark of the last count which saw every ID
+		uint32_t mark=0;
+		std::vector<uint64_t> bits;	// bitmap of the numbers seen
+		std::vector<uint8_t> regs;	// sketch of the numbers seen
+
+		uint32_t Next(size_t n);	// a mark not in seen, growing it to n IDs
+	};
+
+	void Freeze();	// merge the pending and the added calls into the graph
+	uint64_t CountAcquaints(uint32_t a, Stamps& st) const;	// acquaints of a
+	void BuildSketches();	// sketches of the numbers with many friends
+	// fill acquaints in parallel, calling on_count(first,last) when a chunk of IDs is done
+	void CountAll(const std::function<void(uint32_t,uint32_t)>& on_count=nullptr);
+
+	// Friends in the graph and added since it was built
+	uint64_t Degree(uint32_t v) const;
+	bool Linked(uint32_t a, uint32_t b) const;
+	template<typename F> void ForEachFriend(uint32_t v, F f) const;
 
 private:
-	HashCall calls; // <calling #, vector<called #> >
-	HashAcq acquaints;	// number of acquaints for each caller
+	typedef std::pair<uint64_t,uint32_t> CountId;
+	static constexpr uint32_t kNoSketch=UINT32_MAX;
+
+	// Snapshot file: the header, then the arrays in the order of the sizes, each
+	// padded to 8 bytes
+	struct SnapshotHeader {
+		static constexpr uint32_t kMagic=0x31534641;	// "AFS1"
+		static constexpr uint32_t kVersion=1;
+		static constexpr uint32_t kByteOrder=0x01020304;
+
+		uint32_t magic;
+		uint32_t version;
+		uint32_t byte_order;
+		uint32_t precision;	// of the sketches
+		uint64_t numbers;	// name offsets, graph offsets, hubs, counts and sketch_index: numbers(+1)
+		uint64_t chars;
+		uint64_t slots;
+		uint64_t neighbors;
+		uint64_t bitmap_words;
+		uint64_t words;	// per bitmap
+		uint64_t counted;	// 1 if the counts and the sketch index are saved
+		uint64_t sketch_bytes;
+	};
+
+	// Check every value of the arrays of a snapshot used as an offset or an ID,
+	// throwing runtime_error if one would read out of the mapping
+	static void ValidateSnapshot(const std::string& path, const SnapshotHeader& hdr, const uint64_t* names,
+		const uint32_t* slots, const uint64_t* offsets, const uint32_t* neighbors, const uint32_t* hubs,
+		const uint64_t* bitmaps, const uint32_t* index);
+	void Recount(uint32_t id, uint64_t count);	// set the count of id, keeping ranked current
+	void GainAcquaint(uint32_t a, uint32_t b);	// count b for the friends of a not reaching b
+	// sketch of v and its friends, NULL if none
+	const uint8_t* Sketch(uint32_t v) const {
+		return v<sketch_index.size() && sketch_index[v]!=kNoSketch ? sketches.data()+(uint64_t(sketch_index[v])<<precision) : NULL;
+	}
+	uint8_t* Sketch(uint32_t v) {
+		if(!static_cast<const AcquaintsFinder*>(this)->Sketch(v))
+			return NULL;
+		return sketches.Own().data()+(uint64_t(sketch_index[v])<<precision);
+	}
+	std::vector<NumberCount> Names(size_t k) const;	// first k of ranked
+
+	// The k largest counts seen
+	struct TopK {
+		explicit TopK(size_t k): k(k) {}
+		// more acquaints first, then lower IDs
+		static bool Better(const CountId& x, const CountId& y) {
+			return x.first>y.first || (x.first==y.first && x.second<y.second);
+		}
+		void Offer(uint64_t count, uint32_t id);
+		std::vector<CountId> Sorted() const;	// best first
+
+		size_t k;
+		std::vector<CountId> heap;	// heap by Better, the worst on top
+	};
+
+	NumberPool numbers;	// phone number <-> ID
+	std::shared_ptr<const void> snapshot;	// mapping of the snapshot loaded, if any
+	std::vector<std::pair<uint32_t,uint32_t> > pending;	// calls loaded since the graph was built
+	CallGraph graph;	// friends of every ID
+	std::vector<std::vector<uint32_t> > overlay;	// sorted friends added since the graph was built
+	uint64_t overlay_calls;	// calls in overlay
+	Array<uint64_t> acquaints;	// number of acquaints for each ID
+	bool counted;	// acquaints are current
+	std::vector<CountId> ranked;	// the ranked_k best counts(all if fewer), best first
+	size_t ranked_k;	// 0 if ranked is not current
+	unsigned threads;	// loading and counting threads, 0 for all cores
+	Stamps stamps;	// for AddCall
+	unsigned precision;	// 2^precision registers per sketch, 0 for exact counts
+	Array<uint32_t> sketch_index;	// sketch of every ID, kNoSketch if none
+	Array<uint8_t> sketches;	// sketches of the friends and self of numbers with many friends
 };
 
-// trim from start
-inline std::string& AcquaintsFinder::ltrim(std::string &s) {
-    s.erase(s.begin(), std::find_if(s.begin(), s.end(), std::not1(std::ptr_fun<int, int>(std::isspace))));
-    return s;
+inline uint64_t NumberPool::Hash(std::string_view num) {
+	uint64_t h=14695981039346656037ULL;
+	for(unsigned char c:num) {
+		h^=c;
+		h*=1099511628211ULL;
+	}
+	return h;
+}
+
+inline uint32_t NumberPool::Find(std::string_view num) const {
+	if(slots.empty())
+		return kNone;
+	size_t mask=slots.size()-1;
+	for(size_t i=Hash(num)&mask;slots[i];i=(i+1)&mask) {
+		if(Name(slots[i]-1)==num)
+			return slots[i]-1;
+	}
+	return kNone;
+}
+
+inline uint32_t NumberPool::Intern(std::string_view num) {
+	if(2*(Size()+1)>slots.size())	// keep the load factor below 1/2
+		Rehash(std::max<size_t>(16,2*slots.size()));
+	size_t mask=slots.size()-1;
+	size_t i=Hash(num)&mask;
+	for(;slots[i];i=(i+1)&mask) {
+		if(Name(slots[i]-1)==num)
+			return slots[i]-1;
+	}
+
+	uint32_t id=Size();
+	std::vector<char>& digits=chars.Own();
+	digits.insert(digits.end(),num.begin(),num.end());
+	offsets.Own().push_back(digits.size());
+	slots.Own()[i]=id+1;
+	return id;
+}
+
+inline void NumberPool::Rehash(size_t nslots) {
+	std::vector<uint32_t>& table=slots.Reset();
+	table.assign(nslots,0);
+	size_t mask=nslots-1;
+	for(uint32_t id=0;id<Size();++id) {
+		size_t i=Hash(Name(id))&mask;
+		while(table[i])
+			i=(i+1)&mask;
+		table[i]=id+1;
+	}
+}
+
+inline unsigned HyperLogLog::Precision(double error) {
+	double regs=1.04*1.04/(error*error);
+	unsigned precision=4;
+	while(precision<16 && (1u<<precision)<regs)
+		precision++;
+	return precision;
+}
+
+// The first bits of a hash of id select a register, which keeps the longest run
+// of leading zeros in the other bits.
+inline void HyperLogLog::Insert(uint8_t* regs, unsigned precision, uint32_t id) {
+	uint64_t h=id+0x9e3779b97f4a7c15ULL;	// splitmix64
+	h=(h^(h>>30))*0xbf58476d1ce4e5b9ULL;
+	h=(h^(h>>27))*0x94d049bb133111ebULL;
+	h^=h>>31;
+	uint64_t rest=h<<precision|1ULL<<(precision-1);	// not all zeros
+	uint8_t rank=__builtin_clzll(rest)+1;
+	uint8_t& r=regs[h>>(64-precision)];
+	if(r<rank)
+		r=rank;
+}
+
+inline void HyperLogLog::Merge(uint8_t* regs, const uint8_t* other, unsigned precision) {
+	for(size_t i=0;i<(1u<<precision);++i)
+		regs[i]=std::max(regs[i],other[i]);
 }
 
-// trim from end
-inline std::string& AcquaintsFinder::rtrim(std::string &s) {
-    s.erase(std::find_if(s.rbegin(), s.rend(), std::not1(std::ptr_fun<int, int>(std::isspace))).base(), s.end());
-    return s;
+// Harmonic mean of the registers, or linear counting of the empty registers
+// for small sets
+inline double HyperLogLog::Estimate(const uint8_t* regs, unsigned precision) {
+	size_t m=1u<<precision, zeros=0;
+	double sum=0;
+	for(size_t i=0;i<m;++i) {
+		sum+=std::ldexp(1.0,-regs[i]);
+		zeros+=regs[i]==0;
+	}
+	double alpha= m==16 ? 0.673 : m==32 ? 0.697 : m==64 ? 0.709 : 0.7213/(1+1.079/m);
+	double estimate=alpha*m*m/sum;
+	if(estimate<=2.5*m && zeros>0)
+		estimate=m*std::log(double(m)/zeros);
+	return estimate;
+}
+
+// A bit test if either is a hub, else a binary search in the shorter friend list
+inline bool CallGraph::Adjacent(uint32_t a, uint32_t b) const {
+	if(const uint64_t* bits=Bitmap(a))
+		return TestBit(bits,b);
+	if(const uint64_t* bits=Bitmap(b))
+		return TestBit(bits,a);
+	if(Degree(a)>Degree(b))
+		std::swap(a,b);
+	return std::binary_search(begin(a),end(a),b);
+}
+
+// The bits of two hubs are intersected word by word, the shorter list against the
+// bitmap of a hub bit by bit, and two lists by Intersect.
+inline uint64_t CallGraph::CommonFriends(uint32_t a, uint32_t b) const {
+	if(Degree(a)>Degree(b))
+		std::swap(a,b);
+	const uint64_t *abits=Bitmap(a), *bbits=Bitmap(b);
+	uint64_t common=0;
+	if(abits && bbits) {
+		for(uint64_t i=0;i<words;++i)
+			common+=__builtin_popcountll(abits[i]&bbits[i]);
+		return common;
+	}
+	if(bbits) {
+		for(const uint32_t* x=begin(a);x!=end(a);++x)
+			common+=TestBit(bbits,*x);
+		return common;
+	}
+	return Intersect(begin(a),end(a),begin(b),end(b));
+}
+
+// Merge the two sorted lists, or look up the shorter one in the longer one by
+// binary searches when their sizes are far apart. With SSE2 the merge compares
+// four values of x with four of y at once: y is rotated three times, every value
+// of x matches one of y at most, and the block with the lower last value moves on.
+inline uint64_t CallGraph::Intersect(const uint32_t* x, const uint32_t* xend, const uint32_t* y, const uint32_t* yend) {
+	if(xend-x>yend-y) {
+		std::swap(x,y);
+		std::swap(xend,yend);
+	}
+	uint64_t common=0;
+	if((xend-x)*16<yend-y) {
+		for(;x!=xend;++x) {
+			y=std::lower_bound(y,yend,*x);
+			if(y==yend)
+				break;
+			common+=*y==*x;
+		}
+		return common;
+	}
+#ifdef __SSE2__
+	while(xend-x>=4 && yend-y>=4) {
+		__m128i vx=_mm_loadu_si128(reinterpret_cast<const __m128i*>(x));
+		__m128i vy=_mm_loadu_si128(reinterpret_cast<const __m128i*>(y));
+		__m128i eq=_mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi32(vx,vy),_mm_cmpeq_epi32(vx,_mm_shuffle_epi32(vy,_MM_SHUFFLE(0,3,2,1)))),
+			_mm_or_si128(_mm_cmpeq_epi32(vx,_mm_shuffle_epi32(vy,_MM_SHUFFLE(1,0,3,2))),
+				_mm_cmpeq_epi32(vx,_mm_shuffle_epi32(vy,_MM_SHUFFLE(2,1,0,3)))));
+		common+=__builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(eq)));
+		uint32_t xlast=x[3], ylast=y[3];
+		if(xlast<=ylast)
+			x+=4;
+		if(ylast<=xlast)
+			y+=4;
+	}
+#endif
+	while(x!=xend && y!=yend) {
+		if(*x<*y) {
+			++x;
+		} else if(*y<*x) {
+			++y;
+		} else {
+			common++;
+			++x;
+			++y;
+		}
+	}
+	return common;
+}
+
+// Counting sort of both directions of every call into the rows, then sort and
+// deduplicate every row in place.
+inline void CallGraph::Build(uint32_t n, const std::vector<std::pair<uint32_t,uint32_t> >& calls) {
+	std::vector<uint64_t>& off=offsets.Reset();
+	off.assign(n+1,0);
+	for(const auto& c:calls) {
+		if(c.first==c.second)
+			continue;
+		off[c.first+1]++;
+		off[c.second+1]++;
+	}
+	for(uint32_t v=0;v<n;++v)
+		off[v+1]+=off[v];
+
+	std::vector<uint32_t>& nbr=neighbors.Reset();
+	nbr.resize(off[n]);
+	std::vector<uint64_t> pos(off.begin(),off.end()-1);
+	for(const auto& c:calls) {
+		if(c.first==c.second)
+			continue;
+		nbr[pos[c.first]++]=c.second;
+		nbr[pos[c.second]++]=c.first;
+	}
+
+	uint64_t out=0;
+	for(uint32_t v=0;v<n;++v) {
+		uint32_t* first=nbr.data()+off[v];
+		uint32_t* last=nbr.data()+off[v+1];
+		std::sort(first,last);
+		last=std::unique(first,last);
+		off[v]=out;
+		out=std::copy(first,last,nbr.data()+out)-nbr.data();
+	}
+	off[n]=out;
+	nbr.resize(out);
+	nbr.shrink_to_fit();
+
+	// A bitmap of n bits is not larger than a list of n/32 friends
+	words=(n+63)/64;
+	std::vector<uint32_t>& index=hubs.Reset();
+	index.assign(n,kNoBitmap);
+	uint32_t nhubs=0;
+	for(uint32_t v=0;v<n;++v) {
+		if(Degree(v)>=kHubDegree && Degree(v)*32>=n)
+			index[v]=nhubs++;
+	}
+	std::vector<uint64_t>& bits=bitmaps.Reset();
+	bits.assign(nhubs*words,0);
+	bits.shrink_to_fit();
+	for(uint32_t v=0;v<n;++v) {
+		if(index[v]==kNoBitmap)
+			continue;
+		uint64_t* hub=bits.data()+index[v]*words;
+		for(const uint32_t* f=begin(v);f!=end(v);++f)
+			hub[*f>>6]|=1ULL<<(*f&63);
+	}
 }
 
 // trim from both ends
-inline std::string& AcquaintsFinder::trim(std::string &s) {
-    return ltrim(rtrim(s));
-}
-
-
-// Constructor
-HashCall& AcquaintsFinder::LoadCallLog(std::string log) {
-	std::fstream fs(log,std::fstream::in);
-	if(fs.is_open()) {
-		std::string line;	
-		while(std::getline(fs,line)) {
-			// a line is similar to "123456, 222"
-			std::size_t pos=line.find(",");
-			if(pos==std::string::npos) {
-				std::cerr<<"Error: invalid line "<<line<<" found in "<<log<<std::endl;
-				continue;
-			}
+inline std::string_view AcquaintsFinder::Trim(std::string_view s) {
+	const char* spaces=" \t\r\n\f\v";
+	size_t first=s.find_first_not_of(spaces);
+	if(first==std::string_view::npos)
+		return std::string_view();
+	return s.substr(first,s.find_last_not_of(spaces)-first+1);
+}
 
-			std::string calling=line.substr(0,pos); // substring before ','
-			trim(calling); // trim leading & tailing spaces
-			std::string called=line.substr(pos+1);	// substring after ','
-			trim(called);  // trim leading & tailing spaces
-			HashCall::iterator got=calls.find(calling);
-			if(got==calls.end()) {
-				// No record as a key
-				std::unordered_map<std::string,bool> called_hash;
-				called_hash[called]=true;
-				calls[calling]=called_hash;
-			} else {
-				// Has record as key
-				calls[calling][called]=true;
-			}
+// Parse the calls in [first,last), a whole number of lines. Lines and fields are
+// split in place with memchr, which scans a word or a vector at a time, and every
+// number is interned straight from the mapped file. Lines without ',' are kept in
+// invalid to be reported by the caller.
+inline size_t AcquaintsFinder::ParseCalls(const char* first, const char* last, NumberPool& pool,
+		std::vector<std::pair<uint32_t,uint32_t> >& calls, std::vector<std::string_view>& invalid) {
+	size_t ncalls=0;
+	while(first<last) {
+		const char* eol=static_cast<const char*>(memchr(first,'\n',last-first));
+		if(!eol)
+			eol=last;	// no newline at the end of the log
+		// a line is similar to "123456, 222"
+		const char* comma=static_cast<const char*>(memchr(first,',',eol-first));
+		if(!comma) {
+			invalid.push_back(Trim(std::string_view(first,eol-first)));
+		} else {
+			uint32_t calling=pool.Intern(Trim(std::string_view(first,comma-first)));	// before ','
+			uint32_t called=pool.Intern(Trim(std::string_view(comma+1,eol-comma-1)));	// after ','
+			calls.push_back(std::make_pair(calling,called));
+			ncalls++;
 		}
-	} else {
+		first=eol+1;
+	}
+	return ncalls;
+}
+
+// Load calls from a log. The log is mapped into memory rather than read line by
+// line into strings. A large log is cut at newlines into chunks parsed by several
+// threads, each into its own pool of numbers; the chunks are then merged in order,
+// so the IDs are the same as if the log were parsed by one thread. The calls are
+// added to the graph once the whole log is read.
+inline size_t AcquaintsFinder::LoadCallLog(std::string log) {
+	int fd=open(log.c_str(),O_RDONLY);
+	struct stat st;
+	if(fd<0 || fstat(fd,&st)<0) {
 		std::cerr<<"Error: failed to open file "+log+"!"<<std::endl;
 		abort();
 	}
+	size_t size=st.st_size;
+	const char* data=NULL;
+	if(size>0) {
+		void* addr=mmap(NULL,size,PROT_READ,MAP_PRIVATE,fd,0);
+		if(addr==MAP_FAILED) {
+			std::cerr<<"Error: failed to map file "+log+"!"<<std::endl;
+			abort();
+		}
+		madvise(addr,size,MADV_SEQUENTIAL);
+		data=static_cast<const char*>(addr);
+	}
+	close(fd);
+
+	const size_t min_chunk=16<<20;	// smaller chunks are not worth a thread
+	unsigned nthreads=threads ? threads : std::max(1u,std::thread::hardware_concurrency());
+	nthreads=std::max<size_t>(1,std::min<size_t>(nthreads,size/min_chunk));
+
+	size_t ncalls=0;
+	std::vector<std::string_view> invalid;
+	if(nthreads==1) {
+		ncalls=ParseCalls(data,data+size,numbers,pending,invalid);
+	} else {
+		std::vector<const char*> bounds(nthreads+1,data+size);
+		bounds[0]=data;
+		for(unsigned i=1;i<nthreads;++i) {	// move every cut after the next newline
+			const char* cut=std::max(bounds[i-1],data+size/nthreads*i);
+			const char* eol=static_cast<const char*>(memchr(cut,'\n',data+size-cut));
+			bounds[i]=eol ? eol+1 : data+size;
+		}
+
+		struct Chunk {
+			NumberPool pool;
+			std::vector<std::pair<uint32_t,uint32_t> > calls;
+			std::vector<std::string_view> invalid;
+		};
+		std::vector<Chunk> chunks(nthreads);
+		std::vector<std::thread> workers;
+		for(unsigned i=0;i<nthreads;++i) {
+			workers.push_back(std::thread([&,i]() {
+				ParseCalls(bounds[i],bounds[i+1],chunks[i].pool,chunks[i].calls,chunks[i].invalid);
+			}));
+		}
+		for(auto& w:workers)
+			w.join();
+
+		for(Chunk& chunk:chunks) {	// map the IDs of every chunk to global IDs
+			std::vector<uint32_t> ids(chunk.pool.Size());
+			for(uint32_t id=0;id<ids.size();++id)
+				ids[id]=numbers.Intern(chunk.pool.Name(id));
+			for(const auto& c:chunk.calls)
+				pending.push_back(std::make_pair(ids[c.first],ids[c.second]));
+			ncalls+=chunk.calls.size();
+			invalid.insert(invalid.end(),chunk.invalid.begin(),chunk.invalid.end());
+			chunk=Chunk();	// release the chunk early
+		}
+	}
+	for(std::string_view line:invalid)
+		std::cerr<<"Error: invalid line "<<line<<" found in "<<log<<std::endl;
+	if(data)
+		munmap(const_cast<char*>(data),size);
+
+	if(ncalls>0)
+		counted=false;	// recounted from scratch, cheaper than adding the calls one by one
+	Freeze();
+	return ncalls;
+}
+
+// The calls already in the graph are added back once, from the lower ID
+inline void AcquaintsFinder::Freeze() {
+	if(pending.empty() && overlay_calls==0 && graph.Size()==numbers.Size())
+		return;
+	for(uint32_t v=0;v<numbers.Size();++v) {
+		ForEachFriend(v,[&](uint32_t f) {
+			if(v<f)
+				pending.push_back(std::make_pair(v,f));
+		});
+	}
+	graph.Build(numbers.Size(),pending);
+	pending.clear();
+	pending.shrink_to_fit();
+	overlay.clear();
+	overlay_calls=0;
+}
+
+inline uint64_t AcquaintsFinder::Degree(uint32_t v) const {
+	return (v<graph.Size() ? graph.Degree(v) : 0)+(v<overlay.size() ? overlay[v].size() : 0);
+}
+
+inline bool AcquaintsFinder::Linked(uint32_t a, uint32_t b) const {
+	if(a<graph.Size() && b<graph.Size() && graph.Adjacent(a,b))
+		return true;
+	return a<overlay.size() && std::binary_search(overlay[a].begin(),overlay[a].end(),b);
+}
+
+template<typename F>
+void AcquaintsFinder::ForEachFriend(uint32_t v, F f) const {
+	if(v<graph.Size()) {
+		for(const uint32_t* p=graph.begin(v);p!=graph.end(v);++p)
+			f(*p);
+	}
+	if(v<overlay.size()) {
+		for(uint32_t u:overlay[v])
+			f(u);
+	}
+}
+
+// Before they are counted, calls are just kept for the next graph. After, a new
+// friendship a-b changes the friends of friends of a, b and their friends only:
+// 		- a and b are recounted, as they reach the friends of each other;
+// 		- a friend of a gets b as acquaint, unless it is a friend of b or shares
+// 		  a friend with b already, and the other way round.
+// The added friends are kept in the overlay, merged into the graph once they grow
+// too many.
+inline void AcquaintsFinder::AddCall(std::string_view a, std::string_view b) {
+	uint32_t x=numbers.Intern(Trim(a)), y=numbers.Intern(Trim(b));
+	if(!counted) {
+		pending.push_back(std::make_pair(x,y));
+		return;
+	}
+	if(overlay.size()<numbers.Size())
+		overlay.resize(numbers.Size());
+	while(acquaints.size()<numbers.Size()) {	// new numbers without acquaints
+		acquaints.Own().push_back(0);
+		Recount(acquaints.size()-1,0);
+	}
+	if(x==y || Linked(x,y))
+		return;
+
+	GainAcquaint(x,y);
+	GainAcquaint(y,x);
+	overlay[x].insert(std::lower_bound(overlay[x].begin(),overlay[x].end(),y),y);
+	overlay[y].insert(std::lower_bound(overlay[y].begin(),overlay[y].end(),x),x);
+	if(uint8_t* sketch=Sketch(x))
+		HyperLogLog::Insert(sketch,precision,y);
+	if(uint8_t* sketch=Sketch(y))
+		HyperLogLog::Insert(sketch,precision,x);
+	Recount(x,CountAcquaints(x,stamps));
+	Recount(y,CountAcquaints(y,stamps));
+	if(++overlay_calls>graph.neighbors.size()/16+65536)	// over 1/8 of the calls in the graph
+		Freeze();
+}
+
+// Called before a and b are friends: the friends of b are marked, and a friend f of
+// a reaches b already if it is marked or shares a friend with b. In the graph, the
+// friend lists of f and b are intersected by CommonFriends; the few friends added
+// since are checked against the marks of the friends of b, or looked up in f's list.
+inline void AcquaintsFinder::GainAcquaint(uint32_t a, uint32_t b) {
+	uint32_t mark=stamps.Next(numbers.Size());
+	ForEachFriend(b,[&](uint32_t g) {stamps.seen[g]=mark;});
+	auto in_graph=[&](uint32_t v) {return v<graph.Size();};
+	ForEachFriend(a,[&](uint32_t f) {
+		if(stamps.seen[f]==mark)
+			return;
+		bool reached=in_graph(f) && in_graph(b) && graph.CommonFriends(f,b)>0;
+		for(uint32_t g:overlay[f])
+			reached=reached || stamps.seen[g]==mark;
+		for(uint32_t g:overlay[b])
+			reached=reached || (in_graph(f) && in_graph(g) && graph.Adjacent(f,g));
+		if(!reached)
+			Recount(f,acquaints[f]+1);
+	});
+}
+
+// The ranked numbers are the best ranked_k. A number leaving them for a lower
+// count may have to be replaced by one not ranked, so the ranking is dropped.
+inline void AcquaintsFinder::Recount(uint32_t id, uint64_t count) {
+	CountId old(acquaints[id],id), now(count,id);
+	acquaints.Own()[id]=count;
+	if(ranked_k==0)
+		return;
+	auto it=std::lower_bound(ranked.begin(),ranked.end(),old,TopK::Better);
+	if(it!=ranked.end() && *it==old) {
+		if(ranked.size()==ranked_k && TopK::Better(old,now)) {
+			ranked_k=0;
+			ranked.clear();
+			return;
+		}
+		ranked.erase(it);
+	}
+	if(ranked.size()<ranked_k || TopK::Better(now,ranked.back())) {
+		ranked.insert(std::lower_bound(ranked.begin(),ranked.end(),now,TopK::Better),now);
+		if(ranked.size()>ranked_k)
+			ranked.pop_back();
+	}
 }
 
 // Determine if a and b are friends
-bool AcquaintsFinder::IsFriend(std::string a, std::string b) {
-	HashCall::iterator got1=calls.find(a);
-	if(got1!=calls.end()){
-		// Check if b is in a's friend list
-		std::unordered_map<std::string,bool>::iterator got2=calls[a].find(b);
-		if(got2!=calls[a].end())
-			return true; // b is a friend of a
-	}
-
-	got1=calls.find(b);
-	if(got1!=calls.end()){
-		// Check if a is in b's friend list
-		std::unordered_map<std::string,bool>::iterator got2=calls[b].find(a);
-		if(got2!=calls[b].end())
-			return true; // a is a friend of b
-	}
-
-	return false;
-}
-
-// Find the one with most acquaints. Since the hash table is used to store the
-// calls and friends, the time complexity of counting should be O(1) on average.
-std::pair<std::string,int> AcquaintsFinder::FindMostAcquaint() {
-	// Count the number of acquaintants for each calling #
-	for(auto& c:calls) { // go through all calls
-		for(auto& f:c.second) {	// check every friend of current calling #
-			HashCall::iterator got1=calls.find(f.first);
-			if(got1!=calls.end()) {
-				for(auto& aqt:calls[f.first]) { // check every friend's friend
-					if(!IsFriend(c.first,aqt.first)) {
-						HashAcq::iterator got2=acquaints.find(c.first);
-						if(got2==acquaints.end())
-							acquaints[c.first]=1;
-						else
-							acquaints[c.first]++;
-						got2=acquaints.find(aqt.first);
-						if(got2==acquaints.end())
-							acquaints[aqt.first]=1;
-						else
-							acquaints[aqt.first]++;
-					}
-				} // end for
+inline bool AcquaintsFinder::IsFriend(std::string_view a, std::string_view b) {
+	if(!pending.empty())
+		Freeze();
+	uint32_t x=numbers.Find(a), y=numbers.Find(b);
+	if(x==NumberPool::kNone || y==NumberPool::kNone)
+		return false;
+	return Linked(x,y);
+}
+
+inline uint32_t AcquaintsFinder::Stamps::Next(size_t n) {
+	if(seen.size()<n)
+		seen.resize(n,0);
+	if(++mark==0) {	// wrapped around, the old marks could be taken for new ones
+		std::fill(seen.begin(),seen.end(),0);
+		mark=1;
+	}
+	return mark;
+}
+
+// Three ways to count the acquaints of A, taking the cheapest for A's friends:
+// 		- A and its friends are marked, then every friend of a friend not marked yet
+// 		  is an acquaintance, marked so that it is counted once;
+// 		- the bitmaps of friends which are hubs are or-ed into one bitmap of all
+// 		  IDs, together with A, its other friends and their friends;
+// 		- with sketches of r registers, a friend B costs r registers to merge if it
+// 		  has a sketch, or its friends to insert.
+// The last two give the size of A, its friends and acquaintances together.
+inline uint64_t AcquaintsFinder::CountAcquaints(uint32_t a, Stamps& st) const {
+	const uint64_t words=(numbers.Size()+63)/64, regs=1u<<precision;
+	auto hub=[&](uint32_t v) {return v<graph.Size() ? graph.Bitmap(v) : NULL;};
+	auto sketch_cost=[&](uint32_t v) {return Sketch(v) ? regs : Degree(v)+1;};
+	uint64_t visit=0, bitwise=3*words+Degree(a), approx=regs+sketch_cost(a);	// fills and reads of the bits and registers
+	ForEachFriend(a,[&](uint32_t f) {
+		visit+=Degree(f);
+		bitwise+=hub(f) ? graph.words+(f<overlay.size() ? overlay[f].size() : 0) : Degree(f);
+		approx+=sketch_cost(f);
+	});
+
+	if(precision && approx<std::min(visit,bitwise)) {
+		st.regs.assign(regs,0);
+		auto add=[&](uint32_t v) {	// v and its friends
+			if(const uint8_t* sketch=Sketch(v)) {
+				HyperLogLog::Merge(st.regs.data(),sketch,precision);
+			} else {
+				HyperLogLog::Insert(st.regs.data(),precision,v);
+				ForEachFriend(v,[&](uint32_t f) {HyperLogLog::Insert(st.regs.data(),precision,f);});
 			}
-		} // end for
-	} // end for
+		};
+		add(a);
+		ForEachFriend(a,add);
+		double estimate=HyperLogLog::Estimate(st.regs.data(),precision)-Degree(a)-1;
+		return estimate>0 ? std::llround(estimate) : 0;
+	}
+
+	if(bitwise<visit) {
+		st.bits.assign(words,0);
+		uint64_t* bits=st.bits.data();
+		auto set=[&](uint32_t v) {bits[v>>6]|=1ULL<<(v&63);};
+		set(a);
+		ForEachFriend(a,[&](uint32_t b) {
+			set(b);
+			if(const uint64_t* hubbits=hub(b)) {
+				for(uint64_t i=0;i<graph.words;++i)
+					bits[i]|=hubbits[i];
+				if(b<overlay.size())
+					std::for_each(overlay[b].begin(),overlay[b].end(),set);
+			} else {
+				ForEachFriend(b,set);
+			}
+		});
+		uint64_t count=0;
+		for(uint64_t i=0;i<words;++i)
+			count+=__builtin_popcountll(bits[i]);
+		return count-Degree(a)-1;
+	}
+
+	uint32_t mark=st.Next(numbers.Size());
+	st.seen[a]=mark;
+	ForEachFriend(a,[&](uint32_t f) {st.seen[f]=mark;});
+	uint64_t count=0;
+	ForEachFriend(a,[&](uint32_t b) {	// check every friend of a
+		ForEachFriend(b,[&](uint32_t c) {
+			if(st.seen[c]!=mark) {
+				st.seen[c]=mark;
+				count++;
+			}
+		});
+	});
+	return count;
+}
+
+// Only numbers with at least as many friends as registers get a sketch, so the
+// sketches take 2 bytes per call at most.
+inline void AcquaintsFinder::BuildSketches() {
+	std::vector<uint32_t>& index=sketch_index.Reset();
+	std::vector<uint8_t>& regs=sketches.Reset();
+	if(!precision)
+		return;
+	uint32_t nsketches=0;
+	index.assign(numbers.Size(),kNoSketch);
+	for(uint32_t v=0;v<numbers.Size();++v) {
+		if(Degree(v)>=(1u<<precision))
+			index[v]=nsketches++;
+	}
+	regs.assign(uint64_t(nsketches)<<precision,0);
+	for(uint32_t v=0;v<numbers.Size();++v) {
+		if(uint8_t* sketch=Sketch(v)) {
+			HyperLogLog::Insert(sketch,precision,v);
+			ForEachFriend(v,[&](uint32_t f) {HyperLogLog::Insert(sketch,precision,f);});
+		}
+	}
+}
 
-	// Find the numbers with the most acquaintance using a heap
-	struct greaterPair{
-		bool operator() (std::pair<std::string, int>& x, std::pair<std::string, int>& y) {return x.second > y.second;}
+inline void AcquaintsFinder::SetApproximate(double error) {
+	precision=error>0 ? HyperLogLog::Precision(error) : 0;
+	counted=false;	// recounted by the next query
+}
+
+// The work per number varies with the degrees of its friends, so the workers
+// take small chunks of IDs from a shared counter rather than fixed ranges.
+inline void AcquaintsFinder::CountAll(const std::function<void(uint32_t,uint32_t)>& on_count) {
+	const uint32_t chunk=256;
+	uint32_t n=graph.Size();
+	std::vector<uint64_t>& counts=acquaints.Reset();
+	counts.assign(n,0);
+	BuildSketches();
+	unsigned nthreads=threads ? threads : std::max(1u,std::thread::hardware_concurrency());
+	nthreads=std::min<uint64_t>(nthreads,(n+chunk-1)/chunk);
+
+	std::atomic<uint32_t> next(0);
+	auto worker=[&]() {
+		Stamps st;
+		uint32_t first;
+		while((first=next.fetch_add(chunk))<n) {
+			uint32_t last=std::min(n,first+chunk);
+			for(uint32_t a=first;a<last;++a)
+				counts[a]=CountAcquaints(a,st);
+			if(on_count)
+				on_count(first,last);
+		}
+	};
+	std::vector<std::thread> workers;
+	for(unsigned i=1;i<nthreads;++i)
+		workers.push_back(std::thread(worker));
+	worker();	// the calling thread works too
+	for(auto& w:workers)
+		w.join();
+}
+
+// Keep the k best in a min-heap, whose top is the worst of them
+inline void AcquaintsFinder::TopK::Offer(uint64_t count, uint32_t id) {
+	CountId c(count,id);
+	if(heap.size()<k) {
+		heap.push_back(c);
+		std::push_heap(heap.begin(),heap.end(),Better);
+	} else if(k>0 && Better(c,heap.front())) {
+		std::pop_heap(heap.begin(),heap.end(),Better);	// keep the heap small
+		heap.back()=c;
+		std::push_heap(heap.begin(),heap.end(),Better);
+	}
+}
+
+inline std::vector<AcquaintsFinder::CountId> AcquaintsFinder::TopK::Sorted() const {
+	std::vector<CountId> best(heap);
+	std::sort(best.begin(),best.end(),Better);
+	return best;
+}
+
+inline std::vector<AcquaintsFinder::NumberCount> AcquaintsFinder::Names(size_t k) const {
+	std::vector<NumberCount> top;
+	for(size_t i=0;i<k && i<ranked.size();++i)
+		top.push_back(NumberCount(std::string(numbers.Name(ranked[i].second)),ranked[i].first));
+	return top;
+}
+
+// Find the k numbers with most acquaints, in O(m*log(k)) after counting. The
+// counts are kept up to date by AddCall, and so is the ranking of the largest k
+// asked for, unless one of them decreases.
+inline std::vector<AcquaintsFinder::NumberCount> AcquaintsFinder::FindTopAcquaints(size_t k) {
+	if(!counted) {
+		Freeze();
+		CountAll();
+		counted=true;
+		ranked_k=0;
+	}
+	if(ranked_k<k) {
+		TopK top(k);
+		for(uint32_t id=0;id<acquaints.size();++id)
+			top.Offer(acquaints[id],id);
+		ranked=top.Sorted();
+		ranked_k=k;
+	}
+	return Names(k);
+}
+
+// Every worker merges the counts of its chunk into the shared top k, and the one
+// finding the last publication older than period publishes the top k so far. The
+// counts of a chunk are final when it is merged, so a partial top k only misses
+// the numbers not counted yet.
+inline std::vector<AcquaintsFinder::NumberCount> AcquaintsFinder::FindTopAcquaints(size_t k,
+		const TopProgress& progress, std::chrono::milliseconds period) {
+	if(counted) {
+		std::vector<NumberCount> result=FindTopAcquaints(k);
+		progress(result,acquaints.size(),acquaints.size());
+		return result;
+	}
+	Freeze();
+	TopK top(k);
+	std::mutex lock;	// guards top and the progress
+	uint32_t done=0;
+	auto published=std::chrono::steady_clock::now();
+	CountAll([&](uint32_t first, uint32_t last) {
+		std::lock_guard<std::mutex> lck(lock);
+		for(uint32_t id=first;id<last;++id)
+			top.Offer(acquaints[id],id);
+		done+=last-first;
+		auto now=std::chrono::steady_clock::now();
+		if(done<graph.Size() && now-published>=period) {
+			published=now;
+			ranked=top.Sorted();
+			progress(Names(k),done,graph.Size());
+		}
+	});
+	counted=true;
+	ranked=top.Sorted();
+	ranked_k=k;
+	std::vector<NumberCount> result=Names(k);
+	progress(result,graph.Size(),graph.Size());
+	return result;
+}
+
+// The pending and added calls are merged into the graph first, so the arrays are
+// written as they are. A new file is written and renamed over path, and mappings
+// of the old file stay valid.
+inline bool AcquaintsFinder::SaveSnapshot(const std::string& path) {
+	Freeze();
+	SnapshotHeader hdr;
+	memset(&hdr,0,sizeof(hdr));
+	hdr.magic=SnapshotHeader::kMagic;
+	hdr.version=SnapshotHeader::kVersion;
+	hdr.byte_order=SnapshotHeader::kByteOrder;
+	hdr.numbers=numbers.Size();
+	hdr.chars=numbers.chars.size();
+	hdr.slots=numbers.slots.size();
+	hdr.neighbors=graph.neighbors.size();
+	hdr.bitmap_words=graph.bitmaps.size();
+	hdr.words=graph.words;
+	hdr.counted=counted;
+	if(counted) {
+		hdr.precision=precision;
+		hdr.sketch_bytes=sketches.size();
+	}
+	// counts of numbers added since the sketches were built have no sketch
+	std::vector<uint32_t> index(sketch_index.data(),sketch_index.data()+sketch_index.size());
+	index.resize(hdr.numbers,kNoSketch);
+
+	std::string tmp=path+".tmp";
+	FILE* fp=fopen(tmp.c_str(),"wb");
+	if(!fp) {
+		std::cerr<<"Error: failed to create file "+tmp+": "<<strerror(errno)<<std::endl;
+		return false;
+	}
+	bool ok=true;
+	auto write=[&](const void* data, size_t bytes) {
+		static const char zeros[8]={0};
+		ok=ok && (bytes==0 || fwrite(data,1,bytes,fp)==bytes) && fwrite(zeros,1,-bytes&7,fp)==(-bytes&7);
 	};
-	//// heap is used here just for the convenience of expanding to finding N items ////
-	std::priority_queue<std::pair<std::string, int>,std::vector<std::pair<std::string, int> >, greaterPair> heap;
-	const int heap_len=1; 	
-	for(auto& ac:acquaints) {
-		if(heap.size()<heap_len){
-			heap.push(std::pair<std::string,int>(ac.first,ac.second));
-		} else if(heap.top().second<ac.second) {
-			heap.pop(); // keep the heap small 
-			heap.push(std::pair<std::string,int>(ac.first,ac.second));
+	write(&hdr,sizeof(hdr));
+	write(numbers.chars.data(),hdr.chars);
+	write(numbers.offsets.data(),(hdr.numbers+1)*sizeof(uint64_t));
+	write(numbers.slots.data(),hdr.slots*sizeof(uint32_t));
+	write(graph.offsets.data(),(hdr.numbers+1)*sizeof(uint64_t));
+	write(graph.neighbors.data(),hdr.neighbors*sizeof(uint32_t));
+	write(graph.hubs.data(),hdr.numbers*sizeof(uint32_t));
+	write(graph.bitmaps.data(),hdr.bitmap_words*sizeof(uint64_t));
+	if(counted) {
+		write(acquaints.data(),hdr.numbers*sizeof(uint64_t));
+		write(index.data(),hdr.numbers*sizeof(uint32_t));
+		write(sketches.data(),hdr.sketch_bytes);
+	}
+	ok=fclose(fp)==0 && ok;
+	if(!ok || rename(tmp.c_str(),path.c_str())!=0) {
+		std::cerr<<"Error: failed to write file "+path+": "<<strerror(errno)<<std::endl;
+		remove(tmp.c_str());
+		return false;
+	}
+	return true;
+}
+
+// The offsets and IDs in the arrays are checked once, reading them through; the
+// digits, bitmaps, counts and sketches are trusted to be written by SaveSnapshot.
+// A number ID may be found once in the hash table and in every friend list, and
+// every hub and sketch must lie within its array.
+inline void AcquaintsFinder::ValidateSnapshot(const std::string& path, const SnapshotHeader& hdr, const uint64_t* names,
+		const uint32_t* slots, const uint64_t* offsets, const uint32_t* neighbors, const uint32_t* hubs,
+		const uint64_t* bitmaps, const uint32_t* index) {
+	auto corrupt=[&](const char* what) {
+		throw std::runtime_error("AcquaintsFinder: corrupt snapshot "+path+": "+what);
+	};
+	const uint64_t n=hdr.numbers;
+	for(uint64_t v=0;v<n;++v) {
+		if(names[v]>names[v+1])
+			corrupt("bad name offsets");
+		if(offsets[v]>offsets[v+1])
+			corrupt("bad friend list offsets");
+		for(uint64_t i=offsets[v];i<offsets[v+1];++i) {	// sorted friends, not v itself
+			if(neighbors[i]>=n || neighbors[i]==v || (i>offsets[v] && neighbors[i]<=neighbors[i-1]))
+				corrupt("bad friend list");
 		}
-	} // end for
-	while(heap.size()>1) {
-//		std::cout<<heap.top().first<<", "<<heap.top().second<<std::endl; // TEST ONLY
-		heap.pop();
 	}
 
-	return heap.top();
+	std::vector<bool> hashed(n,false);
+	uint64_t nhashed=0;
+	for(uint64_t i=0;i<hdr.slots;++i) {	// ID+1, 0 if empty
+		if(slots[i]==0)
+			continue;
+		if(slots[i]>n || hashed[slots[i]-1])
+			corrupt("bad hash table");
+		hashed[slots[i]-1]=true;
+		nhashed++;
+	}
+	if(nhashed!=n)
+		corrupt("bad hash table");
+
+	const uint64_t tail=n%64 ? ~0ULL<<(n%64) : 0;	// bits past the last number
+	for(uint64_t v=0;v<n;++v) {
+		if(hubs[v]==CallGraph::kNoBitmap)
+			continue;
+		if((hubs[v]+1)*hdr.words>hdr.bitmap_words || (hdr.words && bitmaps[(hubs[v]+1)*hdr.words-1]&tail))
+			corrupt("bad hub bitmap");
+	}
+	for(uint64_t v=0;index && v<n;++v) {
+		if(index[v]==kNoSketch)
+			continue;
+		if(hdr.precision<4 || (uint64_t(index[v])+1)<<hdr.precision>hdr.sketch_bytes)
+			corrupt("bad sketch index");
+	}
+}
+
+// The snapshot replaces everything loaded before.
+inline bool AcquaintsFinder::LoadSnapshot(const std::string& path) {
+	int fd=open(path.c_str(),O_RDONLY);
+	struct stat st;
+	if(fd<0 || fstat(fd,&st)<0) {
+		std::cerr<<"Error: failed to open file "+path+"!"<<std::endl;
+		if(fd>=0)
+			close(fd);
+		return false;
+	}
+	size_t size=st.st_size;
+	if(size<sizeof(SnapshotHeader)) {
+		std::cerr<<"Error: not a snapshot in "<<path<<std::endl;
+		close(fd);
+		return false;
+	}
+	void* addr=mmap(NULL,size,PROT_READ,MAP_SHARED,fd,0);
+	close(fd);
+	if(addr==MAP_FAILED) {
+		std::cerr<<"Error: failed to map file "+path+"!"<<std::endl;
+		return false;
+	}
+	std::shared_ptr<const void> mapping(addr,[size](const void* p) {munmap(const_cast<void*>(p),size);});
+
+	const char* base=static_cast<const char*>(addr);
+	const SnapshotHeader& hdr=*reinterpret_cast<const SnapshotHeader*>(base);
+	const char* error=NULL;
+	if(hdr.byte_order!=SnapshotHeader::kByteOrder)
+		error="written with a different byte order";
+	else if(hdr.magic!=SnapshotHeader::kMagic)
+		error="not a snapshot";
+	else if(hdr.version!=SnapshotHeader::kVersion)
+		error="unsupported version";
+	else if(hdr.numbers>=NumberPool::kNone || hdr.words!=(hdr.numbers+63)/64 || hdr.precision>16
+			|| (hdr.slots & (hdr.slots-1)) || hdr.slots<2*hdr.numbers)
+		error="bad sizes";
+	if(error) {
+		std::cerr<<"Error: "<<error<<" in "<<path<<std::endl;
+		return false;
+	}
+
+	// Offsets of the arrays, every one checked to end within the file before its
+	// size is added, so that no count from the header can overflow the position
+	uint64_t pos=sizeof(SnapshotHeader);
+	bool fits=true;
+	auto next=[&](uint64_t count, uint64_t width) {
+		uint64_t at=pos;
+		fits=fits && count<=(size-pos)/width;
+		if(fits)
+			pos=std::min<uint64_t>(size,pos+((count*width+7)&~7ULL));
+		return at;
+	};
+	uint64_t n=hdr.numbers;
+	uint64_t chars_at=next(hdr.chars,1), names_at=next(n+1,8), slots_at=next(hdr.slots,4);
+	uint64_t offsets_at=next(n+1,8), neighbors_at=next(hdr.neighbors,4), hubs_at=next(n,4);
+	uint64_t bitmaps_at=next(hdr.bitmap_words,8);
+	uint64_t counts_at=0, index_at=0, sketches_at=0;
+	if(hdr.counted) {
+		counts_at=next(n,8);
+		index_at=next(n,4);
+		sketches_at=next(hdr.sketch_bytes,1);
+	}
+	const uint64_t* names=reinterpret_cast<const uint64_t*>(base+names_at);
+	const uint64_t* offsets=reinterpret_cast<const uint64_t*>(base+offsets_at);
+	if(!fits || pos!=size || names[0]!=0 || names[n]!=hdr.chars || offsets[0]!=0 || offsets[n]!=hdr.neighbors) {
+		std::cerr<<"Error: bad sizes in "<<path<<std::endl;
+		return false;
+	}
+	ValidateSnapshot(path,hdr,names,reinterpret_cast<const uint32_t*>(base+slots_at),offsets,
+		reinterpret_cast<const uint32_t*>(base+neighbors_at),reinterpret_cast<const uint32_t*>(base+hubs_at),
+		reinterpret_cast<const uint64_t*>(base+bitmaps_at),hdr.counted ? reinterpret_cast<const uint32_t*>(base+index_at) : NULL);
+
+	numbers.chars.Map(base+chars_at,hdr.chars);
+	numbers.offsets.Map(names,n+1);
+	numbers.slots.Map(reinterpret_cast<const uint32_t*>(base+slots_at),hdr.slots);
+	graph.offsets.Map(offsets,n+1);
+	graph.neighbors.Map(reinterpret_cast<const uint32_t*>(base+neighbors_at),hdr.neighbors);
+	graph.hubs.Map(reinterpret_cast<const uint32_t*>(base+hubs_at),n);
+	graph.bitmaps.Map(reinterpret_cast<const uint64_t*>(base+bitmaps_at),hdr.bitmap_words);
+	graph.words=hdr.words;
+	counted=hdr.counted;
+	precision=hdr.counted ? hdr.precision : precision;
+	if(counted) {
+		acquaints.Map(reinterpret_cast<const uint64_t*>(base+counts_at),n);
+		sketch_index.Map(reinterpret_cast<const uint32_t*>(base+index_at),n);
+		sketches.Map(reinterpret_cast<const uint8_t*>(base+sketches_at),hdr.sketch_bytes);
+	} else {
+		acquaints.Reset();
+		sketch_index.Reset();
+		sketches.Reset();
+	}
+	pending.clear();
+	overlay.clear();
+	overlay_calls=0;
+	ranked.clear();
+	ranked_k=0;
+	snapshot=mapping;
+	return true;
+}
+
+// Find the one with most acquaints. An acquaintance sharing several friends with A
+// is counted once. Without any number, the result is ("",0).
+inline AcquaintsFinder::NumberCount AcquaintsFinder::FindMostAcquaint() {
+	std::vector<NumberCount> top=FindTopAcquaints(1);
+	if(top.empty())
+		return NumberCount(std::string(),0);
+	return top[0];
 }
 
 #endif
@@ -0,0 +1,278 @@
+// Scaling benchmark of AcquaintsFinder on synthetic call logs.
+//
+// For every generator and number of calls(10k, 100k, ... up to -n calls), a call
+// log is generated, then the time to load it, count the acquaints, select the top
+// numbers, save and map a snapshot is measured, with the peak resident set size.
+// The log is generated and measured in two child processes, so that the peak is
+// neither the one of the generator nor of an earlier size. Results are printed as
+// one JSON object per line.
+//
+// Build and run, up to 100M calls(several GB of memory and disk):
+// 		g++ -std=c++17 -O2 -pthread -o finder_bench AcquaintsFinder_Bench.cc
+// 		./finder_bench -n 100000000 > results.jsonl
+#include <chrono>
+#include <random>
+#include <cstdio>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "AcquaintsFinder.h"
+
+static const int kFormatVersion=1;	// bump when fields change meaning
+
+typedef std::chrono::steady_clock BenchClock;
+
+static double ElapsedNs(BenchClock::time_point start) {
+	return std::chrono::duration<double,std::nano>(BenchClock::now()-start).count();
+}
+
+static long PeakRssKb() {
+	struct rusage ru;
+	getrusage(RUSAGE_SELF,&ru);
+	return ru.ru_maxrss;	// KB on Linux
+}
+
+static uint64_t FileSize(const std::string& path) {
+	struct stat st;
+	return stat(path.c_str(),&st)==0 ? st.st_size : 0;
+}
+
+struct Options {
+	uint64_t min_calls=10000;
+	uint64_t max_calls=1000000;
+	unsigned degree=16;	// average friends per number
+	std::string generator;	// all if empty
+	unsigned threads=0;
+	double error=0;
+	size_t top=100;
+	std::string dir=".";	// for the log and the snapshot
+};
+
+// Call logs with power-law degrees
+class Generator {
+public:
+	Generator(const std::string& name, unsigned degree, unsigned seed): name(name), degree(degree), rng(seed) {}
+
+	void Write(const std::string& path, uint64_t ncalls);	// ncalls calls to path
+
+private:
+	void RMat(uint64_t ncalls, std::vector<std::pair<uint32_t,uint32_t> >& calls);
+	void BarabasiAlbert(uint64_t ncalls, std::vector<std::pair<uint32_t,uint32_t> >& calls);
+	void Uniform(uint64_t ncalls, std::vector<std::pair<uint32_t,uint32_t> >& calls);
+
+	std::string name;
+	unsigned degree;
+	std::mt19937_64 rng;
+};
+
+// Recursive matrix: every call falls into one quadrant of the adjacency matrix
+// with probabilities a, b, c, d, and so on into the quadrants of the quadrant.
+void Generator::RMat(uint64_t ncalls, std::vector<std::pair<uint32_t,uint32_t> >& calls) {
+	const double a=0.57, b=0.19, c=0.19;
+	unsigned scale=1;
+	while((1ULL<<scale)*degree<2*ncalls && scale<31)
+		scale++;
+	std::uniform_real_distribution<double> coin(0,1);
+	for(uint64_t i=0;i<ncalls;++i) {
+		uint32_t from=0, to=0;
+		for(unsigned bit=0;bit<scale;++bit) {
+			double p=coin(rng);
+			if(p>=a+b+c) {
+				from|=1u<<bit;
+				to|=1u<<bit;
+			} else if(p>=a+b) {
+				from|=1u<<bit;
+			} else if(p>=a) {
+				to|=1u<<bit;
+			}
+		}
+		calls.push_back(std::make_pair(from,to));
+	}
+}
+
+// Preferential attachment: every new number calls degree/2 numbers chosen in
+// proportion to their friends, by picking a random end of the calls so far.
+void Generator::BarabasiAlbert(uint64_t ncalls, std::vector<std::pair<uint32_t,uint32_t> >& calls) {
+	unsigned per_number=std::max(1u,degree/2);
+	std::vector<uint32_t> ends;
+	ends.reserve(2*ncalls);
+	uint32_t v=per_number+1;
+	for(uint32_t u=0;u<v && calls.size()<ncalls;++u) {	// a small clique to start with
+		for(uint32_t w=u+1;w<v && calls.size()<ncalls;++w) {
+			calls.push_back(std::make_pair(u,w));
+			ends.push_back(u);
+			ends.push_back(w);
+		}
+	}
+	for(;calls.size()<ncalls;++v) {
+		size_t nends=ends.size();
+		for(unsigned i=0;i<per_number && calls.size()<ncalls;++i) {
+			uint32_t w=ends[rng()%nends];
+			calls.push_back(std::make_pair(v,w));
+			ends.push_back(v);
+			ends.push_back(w);
+		}
+	}
+}
+
+void Generator::Uniform(uint64_t ncalls, std::vector<std::pair<uint32_t,uint32_t> >& calls) {
+	uint64_t n=std::max<uint64_t>(2,2*ncalls/degree);
+	for(uint64_t i=0;i<ncalls;++i)
+		calls.push_back(std::make_pair(rng()%n,rng()%n));
+}
+
+// The IDs are mapped to random 10 digit numbers, and the calls shuffled, so that
+// the log has no order the loader could take advantage of.
+void Generator::Write(const std::string& path, uint64_t ncalls) {
+	std::vector<std::pair<uint32_t,uint32_t> > calls;
+	calls.reserve(ncalls);
+	if(name=="rmat") {
+		RMat(ncalls,calls);
+	} else if(name=="ba") {
+		BarabasiAlbert(ncalls,calls);
+	} else if(name=="uniform") {
+		Uniform(ncalls,calls);
+	} else {
+		std::cerr<<"Error: unknown generator "<<name<<std::endl;
+		exit(1);
+	}
+	std::shuffle(calls.begin(),calls.end(),rng);
+
+	uint32_t n=0;
+	for(const auto& c:calls)
+		n=std::max(n,std::max(c.first,c.second)+1);
+	std::vector<uint64_t> phone(n);
+	for(uint32_t i=0;i<n;++i)
+		phone[i]=1000000000ULL+i;
+	std::shuffle(phone.begin(),phone.end(),rng);
+
+	FILE* fp=fopen(path.c_str(),"w");
+	if(!fp) {
+		std::cerr<<"Error: failed to open file "+path+"!"<<std::endl;
+		exit(1);
+	}
+	for(const auto& c:calls)
+		fprintf(fp,"%llu, %llu\n",(unsigned long long)phone[c.first],(unsigned long long)phone[c.second]);
+	fclose(fp);
+}
+
+// Run f in a child process, returning false if it failed
+template<typename F>
+static bool InChild(F f) {
+	pid_t pid=fork();
+	if(pid==0) {
+		f();
+		fflush(stdout);
+		_exit(0);
+	}
+	int status=0;
+	return pid>0 && waitpid(pid,&status,0)==pid && WIFEXITED(status) && WEXITSTATUS(status)==0;
+}
+
+static void Run(const Options& opt, const std::string& gen_name, uint64_t ncalls,
+		const std::string& log, double gen_ns) {
+	std::string snap=opt.dir+"/finder_bench.snap";
+	AcquaintsFinder finder;
+	finder.SetThreads(opt.threads);
+	finder.SetApproximate(opt.error);
+	auto start=BenchClock::now();
+	finder.LoadCallLog(log);
+	double load_ns=ElapsedNs(start);
+	long load_rss=PeakRssKb();
+	uint64_t numbers=finder.GetNumberCount();
+
+	start=BenchClock::now();
+	AcquaintsFinder::NumberCount most=finder.FindMostAcquaint();	// counts all
+	double count_ns=ElapsedNs(start);
+	start=BenchClock::now();
+	std::vector<AcquaintsFinder::NumberCount> top=finder.FindTopAcquaints(opt.top);
+	double top_ns=ElapsedNs(start);
+
+	start=BenchClock::now();
+	finder.SaveSnapshot(snap);
+	double save_ns=ElapsedNs(start);
+	AcquaintsFinder mapped;
+	start=BenchClock::now();
+	mapped.LoadSnapshot(snap);
+	AcquaintsFinder::NumberCount mapped_most=mapped.FindMostAcquaint();
+	double open_ns=ElapsedNs(start);
+	if(mapped_most!=most) {
+		std::cerr<<"snapshot disagrees: "<<mapped_most.first<<" vs "<<most.first<<std::endl;
+		exit(1);
+	}
+
+	printf("{\"bench\":\"acquaints_finder\",\"format\":%d,\"generator\":\"%s\",\"calls\":%llu,\"numbers\":%llu,"
+		"\"degree\":%u,\"threads\":%u,\"error\":%g,\"log_bytes\":%llu,\"gen_ns\":%.0f,"
+		"\"load_ns\":%.0f,\"load_calls_per_s\":%.0f,\"count_ns\":%.0f,\"count_calls_per_s\":%.0f,"
+		"\"top\":%zu,\"top_ns\":%.0f,\"most_acquaints\":%llu,\"save_ns\":%.0f,\"snapshot_bytes\":%llu,"
+		"\"open_ns\":%.0f,\"load_peak_rss_kb\":%ld,\"peak_rss_kb\":%ld}\n",
+		kFormatVersion,gen_name.c_str(),(unsigned long long)ncalls,(unsigned long long)numbers,
+		opt.degree,opt.threads,opt.error,(unsigned long long)FileSize(log),gen_ns,
+		load_ns,ncalls*1e9/load_ns,count_ns,ncalls*1e9/count_ns,
+		top.size(),top_ns,(unsigned long long)most.second,save_ns,(unsigned long long)FileSize(snap),
+		open_ns,load_rss,PeakRssKb());
+	remove(snap.c_str());
+}
+
+int main(int argc, char** argv) {
+	std::string usage="Usage: finder_bench [-m min_calls] [-n max_calls] [-d degree] [-g rmat|ba|uniform] [-t threads] [-e error] [-k top] [-o dir]\n";
+	Options opt;
+
+	int c;
+	while((c=getopt(argc,argv,"hm:n:d:g:t:e:k:o:"))!=-1) {
+		switch(c) {
+			case 'm':
+				opt.min_calls=std::max(1ULL,strtoull(optarg,NULL,10));
+				break;
+			case 'n':
+				opt.max_calls=strtoull(optarg,NULL,10);
+				break;
+			case 'd':
+				opt.degree=std::max(2,atoi(optarg));
+				break;
+			case 'g':
+				opt.generator=optarg;
+				break;
+			case 't':
+				opt.threads=atoi(optarg);
+				break;
+			case 'e':
+				opt.error=atof(optarg);
+				break;
+			case 'k':
+				opt.top=atoi(optarg);
+				break;
+			case 'o':
+				opt.dir=optarg;
+				break;
+			case 'h':
+				std::cout<<usage;
+				return 0;
+			default:
+				std::cerr<<usage;
+				return 1;
+		}
+	}
+
+	const char* generators[]={"rmat","ba","uniform"};
+	if(!opt.generator.empty() && std::find(std::begin(generators),std::end(generators),opt.generator)==std::end(generators)) {
+		std::cerr<<"Error: unknown generator "<<opt.generator<<std::endl<<usage;
+		return 1;
+	}
+	for(const char* g:generators) {
+		if(!opt.generator.empty() && opt.generator!=g)
+			continue;
+		for(uint64_t n=opt.min_calls;n<=opt.max_calls;n*=10) {
+			std::string log=opt.dir+"/finder_bench_calls.txt";
+			auto start=BenchClock::now();
+			bool ok=InChild([&]() {Generator(g,opt.degree,n*31+opt.degree).Write(log,n);});
+			double gen_ns=ElapsedNs(start);
+			ok=ok && InChild([&]() {Run(opt,g,n,log,gen_ns);});
+			remove(log.c_str());
+			if(!ok) {
+				std::cerr<<"Error: run of "<<g<<" with "<<n<<" calls failed"<<std::endl;
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
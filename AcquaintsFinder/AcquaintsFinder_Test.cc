@@ -2,6 +2,7 @@
 #include <ctime>
 #include <unistd.h>
 #include "AcquaintsFinder.h"
+#include "ShardedAcquaintsFinder.h"
 
 const int MAX_CALLS=1e6;
 const int MAX_PHONE_NUM=15; 
@@ -30,13 +31,19 @@ public:
 };
 
 int main(int argc, char** argv) {
-	std::string usage="Usage: finder -i <calls_log>\n";
+	std::string usage="Usage: finder -i <calls_log> [-g] [-t threads] [-k top] [-e error] [-s snapshot] [-S shards -d dir]\n";
 	std::string input="acquaint_input.txt";
 	bool gen_test_calls=false;
+	unsigned threads=0;
+	size_t top=1;
+	double error=0;
+	std::string snapshot;
+	unsigned shards=0;
+	std::string shard_dir=".";
 
 	int c;
 	opterr = 0;
-	while ((c = getopt (argc, argv, "hi:g")) != -1)
+	while ((c = getopt (argc, argv, "hi:gt:k:e:s:S:d:")) != -1)
 		switch (c)
         {
         case 'i':
@@ -45,6 +52,24 @@ int main(int argc, char** argv) {
 		case 'g':
 			gen_test_calls = true;
 			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case 'k':
+			top = atoi(optarg);
+			break;
+		case 'e':
+			error = atof(optarg);
+			break;
+		case 's':
+			snapshot = optarg;
+			break;
+		case 'S':
+			shards = atoi(optarg);
+			break;
+		case 'd':
+			shard_dir = optarg;
+			break;
 		case 'h':
 			std::cout<<usage<<std::endl;
         	return 0;
@@ -63,7 +88,36 @@ int main(int argc, char** argv) {
 		AcquaintsFinder_Test finder_test(input);
 	}
 
-	AcquaintsFinder finder(input);
-	std::pair<std::string,int> most_acquaint=finder.FindMostAcquaint();
-	std::cout<<most_acquaint.first<<" "<<most_acquaint.second<<std::endl;
+	// Logs larger than the memory, in shards processed by -t worker processes
+	if(shards>0) {
+		ShardedAcquaintsFinder sharded(shard_dir,shards);
+		sharded.SetWorkers(threads);
+		for(const auto& nc:sharded.FindTopAcquaints(input,top))
+			std::cout<<nc.first<<" "<<nc.second<<std::endl;
+		return 0;
+	}
+
+	AcquaintsFinder finder;
+	finder.SetThreads(threads);
+	finder.SetApproximate(error);
+	// Reuse the snapshot of an earlier run, or save one after counting
+	bool save_snapshot=false, loaded=false;
+	try {
+		loaded=!snapshot.empty() && access(snapshot.c_str(),F_OK)==0 && finder.LoadSnapshot(snapshot);
+	} catch(const std::exception& e) {
+		std::cerr<<"Error: "<<e.what()<<std::endl;
+	}
+	if(!loaded) {
+		finder.LoadCallLog(input);
+		save_snapshot=!snapshot.empty();
+	}
+	if(top==1) {
+		AcquaintsFinder::NumberCount most_acquaint=finder.FindMostAcquaint();
+		std::cout<<most_acquaint.first<<" "<<most_acquaint.second<<std::endl;
+	} else {
+		for(const auto& nc:finder.FindTopAcquaints(top))
+			std::cout<<nc.first<<" "<<nc.second<<std::endl;
+	}
+	if(save_snapshot)
+		finder.SaveSnapshot(snapshot);
 }
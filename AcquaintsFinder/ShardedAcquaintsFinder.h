@@ -0,0 +1,531 @@
+#ifndef _SHARDEDACQUAINTSFINDER_H_
+#define _SHARDEDACQUAINTSFINDER_H_
+
+// This class finds out the numbers with most acquaintances in call logs larger
+// than the memory, with several worker processes and files in a directory.
+//
+// Phone numbers are strings of at most 19 digits, so they are encoded one to one
+// into 64-bit keys, leading zeros included, instead of being interned. Any other
+// number fails the partition, rather than being counted as another number than by
+// AcquaintsFinder. Every number belongs to a shard chosen by a hash of its key, and
+// the work is done in four phases:
+// 		1. Partition: the log is cut at newlines into parts, and every part writes
+// 		   both directions of its calls into an edge file per shard, edges.<s>.<p>.
+// 		2. Build: the edges of a shard are sorted and written as the sorted friend
+// 		   lists of its numbers, graph.<s>, a file which is used mapped in memory.
+// 		3. Count: for every number A of a shard, the friend lists of its friends are
+// 		   looked up in the graphs of their shards, all mapped read-only, so only the
+// 		   pages needed are read. The acquaints are the friends of friends, but
+// 		   A and its friends, counted through a hash set. The counts of the shard are
+// 		   sorted, best first, into counts.<s>.
+// 		4. Merge: the sorted counts of all shards are merged through a heap of one
+// 		   record per shard, reading the files sequentially.
+// The shards of every phase are shared by the worker processes, and every phase
+// can also be run on its own, e.g. by processes started separately, once the
+// files of the previous phase are complete.
+//
+// Memory - given n calls in s shards: 32*n/s bytes to build a shard, the counts
+// of a shard and a set of the acquaints of one number to count.
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <queue>
+#include <memory>
+#include <algorithm>
+#include <functional>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <thread>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+class ShardedAcquaintsFinder {
+public:
+	typedef std::pair<std::string,uint64_t> NumberCount;	// <phone number, acquaints>
+
+	ShardedAcquaintsFinder(std::string dir, unsigned nshards): dir(dir), nshards(std::max(1u,nshards)), workers(0) {}
+	~ShardedAcquaintsFinder(){}
+
+	void SetWorkers(unsigned n) {workers=n;}	// worker processes, 0 for all cores
+
+	// Run all the phases on log. Ties go to the shorter, then lower number. Without
+	// any number, or if a phase fails, the result is empty.
+	std::vector<NumberCount> FindTopAcquaints(const std::string& log, size_t k);
+	NumberCount FindMostAcquaint(const std::string& log);	// ("",0) without any number
+
+	// The phases. Each returns false on failure, and may run in another process.
+	bool Partition(const std::string& log, unsigned part, unsigned nparts);	// part of nparts of log
+	bool BuildShard(unsigned shard, unsigned nparts);	// from the edge files of nparts parts
+	bool CountShard(unsigned shard);
+	std::vector<NumberCount> MergeTop(size_t k);
+
+protected:
+	typedef std::pair<uint64_t,uint64_t> Edge;	// <number, friend>, <number, number> if alone
+	typedef std::pair<uint64_t,uint64_t> CountNum;	// <acquaints, number>
+
+	// Friend lists of the numbers of a shard, mapped from its graph file
+	class ShardGraph {
+	public:
+		static constexpr uint32_t kMagic=0x31474641;	// "AFG1"
+		static constexpr uint32_t kVersion=1;
+		static constexpr uint32_t kByteOrder=0x01020304;
+
+		ShardGraph(): addr(NULL), size(0), nums(NULL), offsets(NULL), friends(NULL), count(0) {}
+		~ShardGraph() {if(addr) munmap(addr,size);}
+		ShardGraph(const ShardGraph&)=delete;
+		ShardGraph& operator=(const ShardGraph&)=delete;
+
+		bool Open(const std::string& path);
+		static bool Write(const std::string& path, const std::vector<uint64_t>& nums,
+			const std::vector<uint64_t>& offsets, const std::vector<uint64_t>& friends);
+
+		uint64_t Size() const {return count;}
+		uint64_t Number(uint64_t i) const {return nums[i];}
+		const uint64_t* begin(uint64_t i) const {return friends+offsets[i];}
+		const uint64_t* end(uint64_t i) const {return friends+offsets[i+1];}
+		// Friends of num by binary search, an empty list if num is not in the shard
+		std::pair<const uint64_t*,const uint64_t*> Friends(uint64_t num) const;
+
+	private:
+		struct Header {
+			uint32_t magic;
+			uint32_t version;
+			uint32_t byte_order;
+			uint32_t reserved;
+			uint64_t count;	// numbers
+			uint64_t nfriends;
+		};
+
+		void* addr;
+		size_t size;
+		const uint64_t* nums;	// sorted
+		const uint64_t* offsets;	// friends of nums[i]: friends[offsets[i]..offsets[i+1])
+		const uint64_t* friends;	// sorted friend lists
+		uint64_t count;
+	};
+
+	// Open addressing set of numbers, cleared in the time of the numbers inserted
+	class NumberSet {
+	public:
+		NumberSet(): slots(1024,kEmpty) {}
+
+		bool Insert(uint64_t num);	// false if already in
+		void Clear();
+
+	private:
+		static constexpr uint64_t kEmpty=~0ULL;	// not the key of any number
+
+		std::vector<uint64_t> slots;	// power of 2, at most half used
+		std::vector<uint64_t> used;	// indexes of used slots
+	};
+
+	// Key of 1 to 19 digits with spaces around: the keys of d digits follow the ones
+	// of fewer digits, so "0123" and "123" differ. False for any other number.
+	static bool ParseNumber(std::string_view s, uint64_t& num);
+	static std::string NumberOf(uint64_t num);	// digits of a key
+	// more acquaints first, then lower keys
+	static bool Better(const CountNum& x, const CountNum& y) {
+		return x.first>y.first || (x.first==y.first && x.second<y.second);
+	}
+	unsigned ShardOf(uint64_t num) const;
+	std::string PathOf(const char* kind, unsigned shard, int part=-1) const;
+	unsigned Workers() const;
+	bool RunWorkers(unsigned ntasks, const std::function<bool(unsigned)>& task);	// task(0..ntasks-1)
+	static bool WriteFile(const std::string& path, const void* data, size_t bytes, const char* mode);
+
+private:
+	std::string dir;	// of the shard files
+	unsigned nshards;
+	unsigned workers;	// worker processes, 0 for all cores
+};
+
+inline bool ShardedAcquaintsFinder::ParseNumber(std::string_view s, uint64_t& num) {
+	const char* spaces=" \t\r\n\f\v";
+	size_t first=s.find_first_not_of(spaces);
+	if(first==std::string_view::npos)
+		return false;
+	s=s.substr(first,s.find_last_not_of(spaces)-first+1);
+	if(s.size()>19)
+		return false;
+	num=0;
+	for(char c:s) {
+		if(c<'0' || c>'9')
+			return false;
+		num=num*10+(c-'0');
+	}
+	for(uint64_t d=1, p=10;d<s.size();++d, p*=10)	// skip the keys of fewer digits
+		num+=p;
+	return true;
+}
+
+inline std::string ShardedAcquaintsFinder::NumberOf(uint64_t num) {
+	size_t digits=1;
+	for(uint64_t p=10;digits<19 && num>=p;++digits, p*=10)
+		num-=p;
+	std::string s=std::to_string(num);
+	return std::string(digits-s.size(),'0')+s;
+}
+
+inline unsigned ShardedAcquaintsFinder::ShardOf(uint64_t num) const {
+	uint64_t h=num+0x9e3779b97f4a7c15ULL;	// splitmix64
+	h=(h^(h>>30))*0xbf58476d1ce4e5b9ULL;
+	h=(h^(h>>27))*0x94d049bb133111ebULL;
+	return (h^(h>>31))%nshards;
+}
+
+inline std::string ShardedAcquaintsFinder::PathOf(const char* kind, unsigned shard, int part) const {
+	std::string path=dir+"/"+kind+"."+std::to_string(shard);
+	if(part>=0)
+		path+="."+std::to_string(part);
+	return path;
+}
+
+inline unsigned ShardedAcquaintsFinder::Workers() const {
+	return workers ? workers : std::max(1u,std::thread::hardware_concurrency());
+}
+
+// Every worker process takes the tasks w, w+workers, ...
+inline bool ShardedAcquaintsFinder::RunWorkers(unsigned ntasks, const std::function<bool(unsigned)>& task) {
+	unsigned nworkers=std::min(Workers(),ntasks);
+	std::cout.flush();
+	std::cerr.flush();
+	fflush(NULL);	// nothing buffered is written twice
+	std::vector<pid_t> pids;
+	for(unsigned w=0;w<nworkers;++w) {
+		pid_t pid=fork();
+		if(pid==0) {
+			bool ok=true;
+			for(unsigned t=w;t<ntasks && ok;t+=nworkers)
+				ok=task(t);
+			std::cerr.flush();
+			_exit(ok ? 0 : 1);
+		}
+		if(pid<0)
+			std::cerr<<"Error: failed to start a worker: "<<strerror(errno)<<std::endl;
+		else
+			pids.push_back(pid);
+	}
+	bool ok=pids.size()==nworkers;
+	for(pid_t pid:pids) {
+		int status=0;
+		ok=waitpid(pid,&status,0)==pid && WIFEXITED(status) && WEXITSTATUS(status)==0 && ok;
+	}
+	return ok;
+}
+
+inline bool ShardedAcquaintsFinder::WriteFile(const std::string& path, const void* data, size_t bytes, const char* mode) {
+	FILE* fp=fopen(path.c_str(),mode);
+	if(!fp) {
+		std::cerr<<"Error: failed to open file "+path+": "<<strerror(errno)<<std::endl;
+		return false;
+	}
+	bool ok=bytes==0 || fwrite(data,1,bytes,fp)==bytes;
+	ok=fclose(fp)==0 && ok;
+	if(!ok)
+		std::cerr<<"Error: failed to write file "+path+"!"<<std::endl;
+	return ok;
+}
+
+// The part is cut at the newlines following part/nparts and (part+1)/nparts of
+// the log. Edges are buffered per shard and appended to its file when the buffer
+// is full; every file is written even if empty, replacing one of an earlier run.
+inline bool ShardedAcquaintsFinder::Partition(const std::string& log, unsigned part, unsigned nparts) {
+	int fd=open(log.c_str(),O_RDONLY);
+	struct stat st;
+	if(fd<0 || fstat(fd,&st)<0) {
+		std::cerr<<"Error: failed to open file "+log+"!"<<std::endl;
+		if(fd>=0)
+			close(fd);
+		return false;
+	}
+	size_t size=st.st_size;
+	void* addr=size ? mmap(NULL,size,PROT_READ,MAP_PRIVATE,fd,0) : NULL;
+	close(fd);
+	if(addr==MAP_FAILED) {
+		std::cerr<<"Error: failed to map file "+log+"!"<<std::endl;
+		return false;
+	}
+	madvise(addr,size,MADV_SEQUENTIAL);
+	const char* data=static_cast<const char*>(addr);
+	auto cut=[&](unsigned p) {	// start of part p, after the newline next to its share
+		if(p==0 || p>=nparts || size==0)
+			return p==0 ? data : data+size;
+		const char* at=data+size/nparts*p;
+		const char* eol=static_cast<const char*>(memchr(at,'\n',data+size-at));
+		return eol ? eol+1 : data+size;
+	};
+	const char* first=cut(part);
+	const char* last=std::max(first,cut(part+1));
+
+	const size_t buffered=8192;	// edges per shard
+	std::vector<std::vector<Edge> > edges(nshards);
+	std::vector<bool> created(nshards,false);
+	bool ok=true;
+	auto flush=[&](unsigned s) {
+		ok=ok && WriteFile(PathOf("edges",s,part),edges[s].data(),edges[s].size()*sizeof(Edge),created[s] ? "ab" : "wb");
+		created[s]=true;
+		edges[s].clear();
+	};
+	auto add=[&](uint64_t a, uint64_t b) {
+		unsigned s=ShardOf(a);
+		edges[s].push_back(Edge(a,b));
+		if(edges[s].size()>=buffered)
+			flush(s);
+	};
+
+	while(first<last && ok) {
+		const char* eol=static_cast<const char*>(memchr(first,'\n',last-first));
+		if(!eol)
+			eol=last;
+		// a line is similar to "123456, 222"
+		const char* comma=static_cast<const char*>(memchr(first,',',eol-first));
+		std::string_view line(first,eol-first);
+		uint64_t a, b;
+		if(!comma) {
+			std::cerr<<"Error: invalid line "<<line<<" found in "<<log<<std::endl;
+		} else if(ParseNumber(std::string_view(first,comma-first),a) && ParseNumber(std::string_view(comma+1,eol-comma-1),b)) {
+			add(a,b);
+			if(a!=b)
+				add(b,a);
+		} else {
+			std::cerr<<"Error: line "<<line<<" in "<<log<<" has a number of other than 1 to 19 digits"<<std::endl;
+			ok=false;
+		}
+		first=eol+1;
+	}
+	if(addr)
+		munmap(addr,size);
+	for(unsigned s=0;s<nshards;++s)
+		flush(s);
+	return ok;
+}
+
+// The edges of the shard are read back, sorted and deduplicated into the friend
+// lists, then the edge files are removed.
+inline bool ShardedAcquaintsFinder::BuildShard(unsigned shard, unsigned nparts) {
+	std::vector<Edge> edges;
+	for(unsigned p=0;p<nparts;++p) {
+		std::string path=PathOf("edges",shard,p);
+		FILE* fp=fopen(path.c_str(),"rb");
+		if(!fp) {
+			std::cerr<<"Error: failed to open file "+path+"!"<<std::endl;
+			return false;
+		}
+		Edge buf[4096];
+		size_t n;
+		while((n=fread(buf,sizeof(Edge),4096,fp))>0)
+			edges.insert(edges.end(),buf,buf+n);
+		fclose(fp);
+	}
+	std::sort(edges.begin(),edges.end());
+	edges.erase(std::unique(edges.begin(),edges.end()),edges.end());
+
+	std::vector<uint64_t> nums, offsets(1,0), friends;
+	for(const Edge& e:edges) {
+		if(nums.empty() || nums.back()!=e.first) {
+			nums.push_back(e.first);
+			offsets.push_back(offsets.back());
+		}
+		if(e.first!=e.second) {	// else a number calling only itself
+			friends.push_back(e.second);
+			offsets.back()++;
+		}
+	}
+	std::vector<Edge>().swap(edges);
+	if(!ShardGraph::Write(PathOf("graph",shard),nums,offsets,friends))
+		return false;
+	for(unsigned p=0;p<nparts;++p)
+		remove(PathOf("edges",shard,p).c_str());
+	return true;
+}
+
+// The graphs of the other shards are looked up randomly, so they are not read
+// ahead. A number and its friends go into the set first, so the friends of
+// friends inserted afterwards are its acquaints.
+inline bool ShardedAcquaintsFinder::CountShard(unsigned shard) {
+	std::vector<std::unique_ptr<ShardGraph> > graphs(nshards);
+	for(unsigned s=0;s<nshards;++s) {
+		graphs[s].reset(new ShardGraph());
+		if(!graphs[s]->Open(PathOf("graph",s)))
+			return false;
+	}
+	const ShardGraph& own=*graphs[shard];
+
+	std::vector<CountNum> counts;
+	counts.reserve(own.Size());
+	NumberSet seen;
+	for(uint64_t i=0;i<own.Size();++i) {
+		uint64_t a=own.Number(i), count=0;
+		seen.Clear();
+		seen.Insert(a);
+		for(const uint64_t* b=own.begin(i);b!=own.end(i);++b)
+			seen.Insert(*b);
+		for(const uint64_t* b=own.begin(i);b!=own.end(i);++b) {
+			auto fof=graphs[ShardOf(*b)]->Friends(*b);
+			for(const uint64_t* c=fof.first;c!=fof.second;++c)
+				count+=seen.Insert(*c);
+		}
+		counts.push_back(CountNum(count,a));
+	}
+	std::sort(counts.begin(),counts.end(),Better);
+
+	std::string path=PathOf("counts",shard), tmp=path+".tmp";
+	if(!WriteFile(tmp,counts.data(),counts.size()*sizeof(CountNum),"wb") || rename(tmp.c_str(),path.c_str())!=0) {
+		std::cerr<<"Error: failed to write file "+path+"!"<<std::endl;
+		return false;
+	}
+	return true;
+}
+
+// k-way merge of the sorted counts, one buffered record per shard in the heap
+inline std::vector<ShardedAcquaintsFinder::NumberCount> ShardedAcquaintsFinder::MergeTop(size_t k) {
+	struct Head {
+		CountNum record;
+		unsigned shard;
+	};
+	auto worse=[](const Head& x, const Head& y) {return Better(y.record,x.record);};
+	std::priority_queue<Head,std::vector<Head>,decltype(worse)> heap(worse);
+	std::vector<std::unique_ptr<FILE,int(*)(FILE*)> > files;
+	std::vector<NumberCount> top;
+	for(unsigned s=0;s<nshards;++s) {
+		std::string path=PathOf("counts",s);
+		files.emplace_back(fopen(path.c_str(),"rb"),fclose);
+		if(!files.back()) {
+			files.pop_back();
+			std::cerr<<"Error: failed to open file "+path+"!"<<std::endl;
+			return top;
+		}
+		Head h;
+		h.shard=s;
+		if(fread(&h.record,sizeof(CountNum),1,files[s].get())==1)
+			heap.push(h);
+	}
+	while(top.size()<k && !heap.empty()) {
+		Head h=heap.top();
+		heap.pop();
+		top.push_back(NumberCount(NumberOf(h.record.second),h.record.first));
+		if(fread(&h.record,sizeof(CountNum),1,files[h.shard].get())==1)
+			heap.push(h);
+	}
+	return top;
+}
+
+// The log is cut into a part per worker
+inline std::vector<ShardedAcquaintsFinder::NumberCount> ShardedAcquaintsFinder::FindTopAcquaints(const std::string& log, size_t k) {
+	unsigned nparts=Workers();
+	if(!RunWorkers(nparts,[&](unsigned part) {return Partition(log,part,nparts);})
+			|| !RunWorkers(nshards,[&](unsigned shard) {return BuildShard(shard,nparts);})
+			|| !RunWorkers(nshards,[&](unsigned shard) {return CountShard(shard);})) {
+		std::cerr<<"Error: failed to count the acquaints of "<<log<<std::endl;
+		return std::vector<NumberCount>();
+	}
+	return MergeTop(k);
+}
+
+inline ShardedAcquaintsFinder::NumberCount ShardedAcquaintsFinder::FindMostAcquaint(const std::string& log) {
+	std::vector<NumberCount> top=FindTopAcquaints(log,1);
+	if(top.empty())
+		return NumberCount(std::string(),0);
+	return top[0];
+}
+
+inline bool ShardedAcquaintsFinder::NumberSet::Insert(uint64_t num) {
+	uint64_t mask=slots.size()-1;
+	uint64_t h=num*0x9e3779b97f4a7c15ULL;
+	uint64_t i=(h^(h>>32))&mask;
+	while(slots[i]!=kEmpty) {
+		if(slots[i]==num)
+			return false;
+		i=(i+1)&mask;
+	}
+	slots[i]=num;
+	used.push_back(i);
+	if(2*used.size()>slots.size()) {	// grow, reinserting the used slots
+		std::vector<uint64_t> old(2*slots.size(),kEmpty);
+		old.swap(slots);
+		std::vector<uint64_t> nums;
+		nums.reserve(used.size());
+		for(uint64_t u:used)
+			nums.push_back(old[u]);
+		used.clear();
+		for(uint64_t n:nums)
+			Insert(n);
+	}
+	return true;
+}
+
+inline void ShardedAcquaintsFinder::NumberSet::Clear() {
+	if(used.size()*8<slots.size()) {
+		for(uint64_t u:used)
+			slots[u]=kEmpty;
+	} else {
+		std::fill(slots.begin(),slots.end(),kEmpty);
+	}
+	used.clear();
+}
+
+inline bool ShardedAcquaintsFinder::ShardGraph::Write(const std::string& path, const std::vector<uint64_t>& nums,
+		const std::vector<uint64_t>& offsets, const std::vector<uint64_t>& friends) {
+	Header hdr;
+	memset(&hdr,0,sizeof(hdr));
+	hdr.magic=kMagic;
+	hdr.version=kVersion;
+	hdr.byte_order=kByteOrder;
+	hdr.count=nums.size();
+	hdr.nfriends=friends.size();
+	std::string tmp=path+".tmp";
+	bool ok=WriteFile(tmp,&hdr,sizeof(hdr),"wb")
+		&& WriteFile(tmp,nums.data(),nums.size()*sizeof(uint64_t),"ab")
+		&& WriteFile(tmp,offsets.data(),offsets.size()*sizeof(uint64_t),"ab")
+		&& WriteFile(tmp,friends.data(),friends.size()*sizeof(uint64_t),"ab");
+	if(!ok || rename(tmp.c_str(),path.c_str())!=0) {
+		std::cerr<<"Error: failed to write file "+path+"!"<<std::endl;
+		return false;
+	}
+	return true;
+}
+
+inline bool ShardedAcquaintsFinder::ShardGraph::Open(const std::string& path) {
+	int fd=open(path.c_str(),O_RDONLY);
+	struct stat st;
+	if(fd<0 || fstat(fd,&st)<0) {
+		std::cerr<<"Error: failed to open file "+path+"!"<<std::endl;
+		if(fd>=0)
+			close(fd);
+		return false;
+	}
+	size=st.st_size;
+	addr=size>=sizeof(Header) ? mmap(NULL,size,PROT_READ,MAP_SHARED,fd,0) : NULL;
+	close(fd);
+	if(addr==MAP_FAILED)
+		addr=NULL;
+	const Header* hdr=static_cast<const Header*>(addr);
+	if(!hdr || hdr->byte_order!=kByteOrder || hdr->magic!=kMagic || hdr->version!=kVersion
+			|| size!=sizeof(Header)+(2*hdr->count+1+hdr->nfriends)*sizeof(uint64_t)) {
+		std::cerr<<"Error: bad shard graph "+path<<std::endl;
+		return false;
+	}
+	madvise(addr,size,MADV_RANDOM);
+	count=hdr->count;
+	nums=reinterpret_cast<const uint64_t*>(hdr+1);
+	offsets=nums+count;
+	friends=offsets+count+1;
+	return true;
+}
+
+inline std::pair<const uint64_t*,const uint64_t*> ShardedAcquaintsFinder::ShardGraph::Friends(uint64_t num) const {
+	const uint64_t* it=std::lower_bound(nums,nums+count,num);
+	if(it==nums+count || *it!=num)
+		return std::make_pair(friends,friends);
+	return std::make_pair(begin(it-nums),end(it-nums));
+}
+
+#endif
@@ -0,0 +1,329 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <unistd.h>
+#include "my_malloc.h"
+
+// The benchmark calls every allocator explicitly
+#undef malloc
+#undef calloc
+#undef realloc
+#undef free
+
+// An allocator under test
+struct Backend {
+    const char *name;
+    void * (*alloc)(size_t size);
+    void * (*resize)(void *p, size_t size);
+    void (*release)(void *p);
+};
+
+static void * sys_alloc(size_t size) { return ::malloc(size); }
+static void * sys_resize(void *p, size_t size) { return ::realloc(p, size); }
+static void sys_release(void *p) { ::free(p); }
+
+static void * tracked_alloc(size_t size) { return my_malloc(__FILE__, __LINE__, size, MALLOC_FUNC_MALLOC); }
+static void * tracked_resize(void *p, size_t size) { return my_realloc(__FILE__, __LINE__, p, size, MALLOC_FUNC_REALLOC); }
+static void tracked_release(void *p) { my_free(__FILE__, __LINE__, p, MALLOC_FUNC_FREE); }
+
+// New backends are added here
+static const Backend backends[] = {
+    {"system", sys_alloc, sys_resize, sys_release},
+    {"tracked", tracked_alloc, tracked_resize, tracked_release},
+};
+
+typedef std::chrono::steady_clock bench_clock;
+const size_t SAMPLE_EVERY = 16; // latency of every 16th operation is recorded
+
+// Per thread results
+struct ThreadResult {
+    size_t ops;
+    std::vector<uint32_t> lat_ns; // sampled latencies
+
+    ThreadResult(): ops(0) {}
+};
+
+// Times one operation out of SAMPLE_EVERY
+template <typename Op>
+static inline void timed(ThreadResult& res, Op op)
+{
+    if (res.ops++ % SAMPLE_EVERY) {
+        op();
+        return;
+    }
+    auto start = bench_clock::now();
+    op();
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - start).count();
+    res.lat_ns.push_back((uint32_t)std::min<long long>(ns, UINT32_MAX));
+}
+
+// Resident set size in KB
+static long rss_kb()
+{
+    long pages = 0, resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (!fp)
+        return 0;
+    if (fscanf(fp, "%ld %ld", &pages, &resident) != 2)
+        resident = 0;
+    fclose(fp);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Lets the main thread sample RSS while all workers still hold their memory
+class Barrier {
+    public:
+        explicit Barrier(size_t n): _n(n), _arrived(0), _released(false) {}
+        void arrive_and_wait() {
+            _arrived++;
+            while (!_released.load())
+                std::this_thread::yield();
+        }
+        void wait_all() {
+            while (_arrived.load() < _n)
+                std::this_thread::yield();
+        }
+        void release() { _released = true; }
+
+    private:
+        size_t _n;
+        std::atomic<size_t> _arrived;
+        std::atomic<bool> _released;
+};
+
+// Small-object churn: every op frees a random slot of a thread-local working
+// set and refills it with a new 8-256 bytes object.
+static void churn(const Backend& be, size_t nops, unsigned seed, ThreadResult& res, Barrier& bar)
+{
+    const size_t WORKING_SET = 1024;
+    std::vector<void*> slots(WORKING_SET, nullptr);
+    std::mt19937 rng(seed);
+    for (size_t i = 0; i < nops; ++i) {
+        size_t slot = rng() % WORKING_SET;
+        size_t sz = rng() % 249 + 8;
+        timed(res, [&] {
+            if (slots[slot])
+                be.release(slots[slot]);
+            slots[slot] = be.alloc(sz);
+        });
+    }
+    bar.arrive_and_wait();
+    for (auto p : slots)
+        if (p)
+            be.release(p);
+}
+
+// Large reallocs: grow a buffer from 4 KB to 4 MB by 1.5x steps, then start over
+static void grow(const Backend& be, size_t nops, unsigned seed, ThreadResult& res, Barrier& bar)
+{
+    const size_t MIN_SIZE = 4096, MAX_SIZE = 4 << 20;
+    std::mt19937 rng(seed);
+    void *buf = nullptr;
+    size_t sz = 0;
+    for (size_t i = 0; i < nops; ++i) {
+        if (!buf || sz >= MAX_SIZE) {
+            if (buf)
+                timed(res, [&] { be.release(buf); });
+            sz = MIN_SIZE + rng() % MIN_SIZE;
+            timed(res, [&] { buf = be.alloc(sz); });
+        } else {
+            sz += sz / 2;
+            timed(res, [&] { buf = be.resize(buf, sz); });
+        }
+        ((char*)buf)[sz-1] = 1; // touch the tail
+    }
+    bar.arrive_and_wait();
+    be.release(buf);
+}
+
+// Single producer single consumer ring of pointers
+class PointerRing {
+    public:
+        explicit PointerRing(size_t cap): _buf(cap), _head(0), _tail(0) {}
+        bool push(void *p) {
+            size_t t = _tail.load(std::memory_order_relaxed);
+            if (t - _head.load(std::memory_order_acquire) == _buf.size())
+                return false;
+            _buf[t % _buf.size()] = p;
+            _tail.store(t + 1, std::memory_order_release);
+            return true;
+        }
+        bool pop(void *&p) {
+            size_t h = _head.load(std::memory_order_relaxed);
+            if (h == _tail.load(std::memory_order_acquire))
+                return false;
+            p = _buf[h % _buf.size()];
+            _head.store(h + 1, std::memory_order_release);
+            return true;
+        }
+
+    private:
+        std::vector<void*> _buf;
+        std::atomic<size_t> _head;
+        char _pad[64]; // keep head and tail on different cache lines
+        std::atomic<size_t> _tail;
+};
+
+// Cross-thread frees: the producer allocates, its paired consumer frees
+static void producer(const Backend& be, size_t nops, unsigned seed, PointerRing& ring, ThreadResult& res, Barrier& bar)
+{
+    std::mt19937 rng(seed);
+    for (size_t i = 0; i < nops; ++i) {
+        void *p = nullptr;
+        size_t sz = rng() % 1017 + 8;
+        timed(res, [&] { p = be.alloc(sz); });
+        while (!ring.push(p))
+            std::this_thread::yield();
+    }
+    while (!ring.push(nullptr)) // end of stream
+        std::this_thread::yield();
+    bar.arrive_and_wait();
+}
+
+static void consumer(const Backend& be, PointerRing& ring, ThreadResult& res, Barrier& bar)
+{
+    void *p;
+    while (true) {
+        if (!ring.pop(p)) {
+            std::this_thread::yield();
+            continue;
+        }
+        if (!p)
+            break;
+        timed(res, [&] { be.release(p); });
+    }
+    bar.arrive_and_wait();
+}
+
+struct RunResult {
+    double ops_per_sec;
+    uint32_t p50_ns;
+    uint32_t p99_ns;
+    long rss_delta_kb;
+};
+
+static RunResult run(const Backend& be, const std::string& workload, int nthreads, size_t nops)
+{
+    std::vector<std::thread> threads;
+    size_t nworkers = workload == "xthread" ? 2*nthreads : nthreads;
+    std::vector<ThreadResult> results(nworkers);
+    std::vector<PointerRing*> rings;
+    Barrier bar(nworkers);
+
+    long rss0 = rss_kb();
+    auto start = bench_clock::now();
+    for (int i = 0; i < nthreads; ++i) {
+        if (workload == "churn") {
+            threads.push_back(std::thread(churn, std::cref(be), nops, i+1, std::ref(results[i]), std::ref(bar)));
+        } else if (workload == "realloc") {
+            threads.push_back(std::thread(grow, std::cref(be), nops, i+1, std::ref(results[i]), std::ref(bar)));
+        } else {
+            rings.push_back(new PointerRing(4096));
+            threads.push_back(std::thread(producer, std::cref(be), nops, i+1, std::ref(*rings.back()),
+                        std::ref(results[2*i]), std::ref(bar)));
+            threads.push_back(std::thread(consumer, std::cref(be), std::ref(*rings.back()),
+                        std::ref(results[2*i+1]), std::ref(bar)));
+        }
+    }
+    bar.wait_all();
+    double secs = std::chrono::duration<double>(bench_clock::now() - start).count();
+    long rss1 = rss_kb();
+    bar.release();
+    for (auto& thrd : threads)
+        thrd.join();
+    for (auto r : rings)
+        delete r;
+
+    size_t ops = 0;
+    std::vector<uint32_t> lat;
+    for (const auto& r : results) {
+        ops += r.ops;
+        lat.insert(lat.end(), r.lat_ns.begin(), r.lat_ns.end());
+    }
+
+    RunResult res;
+    res.ops_per_sec = ops / secs;
+    res.p50_ns = res.p99_ns = 0;
+    if (!lat.empty()) {
+        std::nth_element(lat.begin(), lat.begin() + lat.size()/2, lat.end());
+        res.p50_ns = lat[lat.size()/2];
+        std::nth_element(lat.begin(), lat.begin() + lat.size()*99/100, lat.end());
+        res.p99_ns = lat[lat.size()*99/100];
+    }
+    res.rss_delta_kb = rss1 - rss0;
+    return res;
+}
+
+int main(int argc, char** argv)
+{
+    std::string usage = "Usage: my_malloc_bench [-t max_threads] [-n ops_per_thread] [-b backend] [-w churn|xthread|realloc]\n";
+    int max_threads = (int)std::max(1u, std::thread::hardware_concurrency());
+    size_t nops = 200000;
+    std::string backend, workload;
+
+    int c;
+    while ((c = getopt(argc, argv, "ht:n:b:w:")) != -1) {
+        switch (c) {
+            case 't':
+                max_threads = std::max(1, atoi(optarg));
+                break;
+            case 'n':
+                nops = strtoull(optarg, NULL, 10);
+                break;
+            case 'b':
+                backend = optarg;
+                break;
+            case 'w':
+                workload = optarg;
+                break;
+            case 'h':
+                std::cout << usage;
+                return 0;
+            default:
+                std::cerr << usage;
+                return 1;
+        }
+    }
+
+    const char *workloads[] = {"churn", "xthread", "realloc"};
+    if (!backend.empty() && std::none_of(std::begin(backends), std::end(backends),
+                                         [&](const Backend& be) { return backend == be.name; })) {
+        std::cerr << "Error: unknown backend " << backend << std::endl << usage;
+        return 1;
+    }
+    if (!workload.empty() && std::find(std::begin(workloads), std::end(workloads), workload) == std::end(workloads)) {
+        std::cerr << "Error: unknown workload " << workload << std::endl << usage;
+        return 1;
+    }
+    std::cout << std::left << std::setw(10) << "backend" << std::setw(10) << "workload"
+        << std::right << std::setw(8) << "threads" << std::setw(14) << "ops/sec"
+        << std::setw(10) << "p50(ns)" << std::setw(10) << "p99(ns)" << std::setw(12) << "rss(KB)" << std::endl;
+    std::vector<int> thread_counts; // powers of two, always finishing with max_threads
+    for (int t = 1; t < max_threads; t *= 2)
+        thread_counts.push_back(t);
+    thread_counts.push_back(max_threads);
+    for (const auto& be : backends) {
+        if (!backend.empty() && backend != be.name)
+            continue;
+        for (const char *w : workloads) {
+            if (!workload.empty() && workload != w)
+                continue;
+            for (int t : thread_counts) {
+                RunResult r = run(be, w, t, nops);
+                std::cout << std::left << std::setw(10) << be.name << std::setw(10) << w
+                    << std::right << std::setw(8) << t << std::setw(14) << (size_t)r.ops_per_sec
+                    << std::setw(10) << r.p50_ns << std::setw(10) << r.p99_ns << std::setw(12) << r.rss_delta_kb << std::endl;
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,231 @@
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "malloc.h"
+
+// Periodically exports stats snapshots to a file or a unix domain socket
+class StatsExporter {
+    public:
+        StatsExporter(): _running(false), _interval_ms(0), _fmt(MALLOC_EXPORT_JSON), _sock(-1) {}
+        ~StatsExporter() { stop(); }
+
+        bool start(const char *dest, unsigned interval_ms, export_format_t fmt);
+        void stop();
+
+    private:
+        void run();
+        bool export_once();
+        bool write_file(const char *data, size_t len);
+        bool send_socket(const char *data, size_t len);
+
+        std::thread _thread;
+        std::mutex _mtx;
+        std::condition_variable _cond;
+        bool _running;
+        unsigned _interval_ms;
+        export_format_t _fmt;
+        std::string _dest;  // file path or socket path
+        int _sock;          // datagram socket, -1 when exporting to a file
+        struct sockaddr_un _addr;
+};
+
+static const char UNIX_PREFIX[] = "unix:";
+
+StatsExporter& stats_exporter()
+{
+    static StatsExporter exporter;
+    return exporter;
+}
+
+bool StatsExporter::start(const char *dest, unsigned interval_ms, export_format_t fmt)
+{
+    std::unique_lock<std::mutex> lck(_mtx);
+    if (_running || !dest || !*dest || !interval_ms)
+        return false;
+
+    _sock = -1;
+    _dest = dest;
+    if (_dest.compare(0, sizeof(UNIX_PREFIX)-1, UNIX_PREFIX) == 0) {
+        _dest.erase(0, sizeof(UNIX_PREFIX)-1);
+        if (_dest.empty() || _dest.size() >= sizeof(_addr.sun_path))
+            return false;
+        _sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (_sock < 0)
+            return false;
+        memset(&_addr, 0, sizeof(_addr));
+        _addr.sun_family = AF_UNIX;
+        memcpy(_addr.sun_path, _dest.c_str(), _dest.size());
+    }
+
+    _interval_ms = interval_ms;
+    _fmt = fmt;
+    _running = true;
+    _thread = std::thread(&StatsExporter::run, this);
+    return true;
+}
+
+void StatsExporter::stop()
+{
+    {
+        std::unique_lock<std::mutex> lck(_mtx);
+        if (!_running)
+            return;
+        _running = false;
+    }
+    _cond.notify_all();
+    _thread.join();
+    if (_sock >= 0) {
+        close(_sock);
+        _sock = -1;
+    }
+}
+
+void StatsExporter::run()
+{
+    std::unique_lock<std::mutex> lck(_mtx);
+    while (_running) {
+        lck.unlock();
+        export_once();
+        lck.lock();
+        _cond.wait_for(lck, std::chrono::milliseconds(_interval_ms), [this] { return !_running; });
+    }
+}
+
+bool StatsExporter::export_once()
+{
+    malloc_stats_t st;
+    st.version = MALLOC_STATS_VERSION;
+    st.size = sizeof(st);
+    if (get_malloc_stats(&st) != 0)
+        return false;
+
+    std::string buf;
+    if (_fmt == MALLOC_EXPORT_BINARY) {
+        buf.assign((const char*)&st, sizeof(st));
+    } else {
+        buf.resize(4096);
+        int len = format_malloc_stats_json(&st, &buf[0], buf.size());
+        if (len < 0)
+            return false;
+        if ((size_t)len >= buf.size()) {
+            buf.resize(len + 1);
+            format_malloc_stats_json(&st, &buf[0], buf.size());
+        }
+        buf.resize(len);
+        buf += '\n';
+    }
+
+    if (_sock >= 0)
+        return send_socket(buf.data(), buf.size());
+    return write_file(buf.data(), buf.size());
+}
+
+// Write to a temporary file and rename it, so readers never see a partial snapshot
+bool StatsExporter::write_file(const char *data, size_t len)
+{
+    std::string tmp = _dest + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return false;
+    size_t off = 0;
+    while (off < len) {
+        ssize_t n = write(fd, data + off, len - off);
+        if (n <= 0) {
+            close(fd);
+            unlink(tmp.c_str());
+            return false;
+        }
+        off += n;
+    }
+    close(fd);
+    return rename(tmp.c_str(), _dest.c_str()) == 0;
+}
+
+// One snapshot per datagram. Dropped if nobody listens on the socket.
+bool StatsExporter::send_socket(const char *data, size_t len)
+{
+    ssize_t n = sendto(_sock, data, len, MSG_DONTWAIT, (const struct sockaddr*)&_addr, sizeof(_addr));
+    return n == (ssize_t)len;
+}
+
+// Escape a call site for a JSON string
+static std::string json_escape(const char *s)
+{
+    std::string out;
+    for (; *s; ++s) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += (char)c;
+        } else if (c < 0x20) {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+            out += esc;
+        } else {
+            out += (char)c;
+        }
+    }
+    return out;
+}
+
+int format_malloc_stats_json(const malloc_stats_t *st, char *buf, size_t len)
+{
+    if (!st)
+        return -1;
+
+    std::string out;
+    char num[128];
+    snprintf(num, sizeof(num), "{\"version\":%" PRIu32 ",\"timestamp\":%" PRId64 ",\"epoch\":%" PRId64,
+            st->version, st->timestamp, st->epoch);
+    out += num;
+    snprintf(num, sizeof(num), ",\"alloc_cnt\":%" PRIu64 ",\"alloc_size\":%" PRIu64, st->alloc_cnt, st->alloc_size);
+    out += num;
+    snprintf(num, sizeof(num), ",\"free_cnt\":%" PRIu64 ",\"free_size\":%" PRIu64, st->free_cnt, st->free_size);
+    out += num;
+    snprintf(num, sizeof(num), ",\"curr_size\":%" PRIu64, st->curr_size);
+    out += num;
+
+    out += ",\"by_size\":[";
+    for (size_t i = 0; i < MALLOC_STATS_SIZE_BUCKETS; ++i) {
+        snprintf(num, sizeof(num), "%s%" PRIu64, i ? "," : "", st->by_size[i]);
+        out += num;
+    }
+    out += "],\"by_age\":[";
+    for (size_t i = 0; i < MALLOC_STATS_AGE_BUCKETS; ++i) {
+        snprintf(num, sizeof(num), "%s%" PRIu64, i ? "," : "", st->by_age[i]);
+        out += num;
+    }
+    out += "],\"sites\":[";
+    for (uint32_t i = 0; i < st->nsites && i < MALLOC_STATS_TOP_SITES; ++i) {
+        const malloc_site_stats_t& site = st->sites[i];
+        out += i ? ",{\"src\":\"" : "{\"src\":\"";
+        out += json_escape(site.src);
+        snprintf(num, sizeof(num), "\",\"live_cnt\":%" PRIu64 ",\"live_bytes\":%" PRIu64 ",\"growth\":%" PRIu64 ",\"mean_age\":%.0f}",
+                site.live_cnt, site.live_bytes, site.growth, site.mean_age);
+        out += num;
+    }
+    out += "]}";
+
+    if (buf && len)
+        snprintf(buf, len, "%s", out.c_str());
+    return (int)out.size();
+}
+
+int start_stats_exporter(const char *dest, unsigned interval_ms, export_format_t fmt)
+{
+    return stats_exporter().start(dest, interval_ms, fmt) ? 0 : -1;
+}
+
+void stop_stats_exporter()
+{
+    stats_exporter().stop();
+}
@@ -0,0 +1,138 @@
+#include <cstdio>
+#include <algorithm>
+#include <chrono>
+#include "leak_detector.h"
+
+GrowthDetector& growth_detector()
+{
+    static GrowthDetector detector;
+    return detector;
+}
+
+bool GrowthDetector::start(unsigned interval_sec, unsigned windows)
+{
+    std::unique_lock<std::mutex> lck(_mtx);
+    if (_running || !interval_sec || windows < 2)
+        return false;
+    _interval = interval_sec;
+    _windows = windows;
+    _history.clear();
+    _running = true;
+    _thread = std::thread(&GrowthDetector::run, this);
+    return true;
+}
+
+void GrowthDetector::stop()
+{
+    {
+        std::unique_lock<std::mutex> lck(_mtx);
+        if (!_running)
+            return;
+        _running = false;
+    }
+    _cond.notify_all();
+    _thread.join();
+}
+
+bool GrowthDetector::running()
+{
+    std::unique_lock<std::mutex> lck(_mtx);
+    return _running;
+}
+
+void GrowthDetector::run()
+{
+    std::unique_lock<std::mutex> lck(_mtx);
+    while (_running) {
+        lck.unlock();
+        sample();
+        lck.lock();
+        _cond.wait_for(lck, std::chrono::seconds(_interval), [this] { return !_running; });
+    }
+}
+
+void GrowthDetector::sample()
+{
+    // Only the site table is copied, the allocation table is never walked
+    auto stats = site_stats();
+
+    std::unique_lock<std::mutex> lck(_mtx);
+    for (const auto& s : stats) {
+        auto& hist = _history[s.first];
+        hist.push_back(s.second.live_bytes);
+        if (hist.size() > _windows)
+            hist.pop_front();
+    }
+}
+
+std::vector<GrowthSite> GrowthDetector::top_sites(size_t topn)
+{
+    std::vector<GrowthSite> growing;
+    std::unordered_map<std::string,SiteStat> curr;
+    for (auto& s : site_stats())
+        curr[s.first] = s.second;
+
+    time_t now = time(NULL);
+    std::unique_lock<std::mutex> lck(_mtx);
+    for (const auto& h : _history) {
+        const std::deque<size_t>& hist = h.second;
+        if (hist.size() < 2 || hist.back() <= hist.front())
+            continue;
+        bool monotonic = true;
+        for (size_t i = 1; i < hist.size() && monotonic; ++i)
+            monotonic = hist[i] >= hist[i-1];
+        if (!monotonic)
+            continue;
+
+        GrowthSite site;
+        site.src = h.first;
+        site.live_bytes = hist.back();
+        site.growth = hist.back() - hist.front();
+        site.live_cnt = 0;
+        site.mean_age = 0;
+        auto it = curr.find(h.first);
+        if (it != curr.end() && it->second.live_cnt) {
+            site.live_cnt = it->second.live_cnt;
+            site.mean_age = difftime(now, (time_t)(it->second.ts_sum / it->second.live_cnt));
+        }
+        growing.push_back(site);
+    }
+    lck.unlock();
+
+    std::sort(growing.begin(), growing.end(), [](const GrowthSite& x, const GrowthSite& y) {
+        return x.growth > y.growth || (x.growth == y.growth && x.src < y.src);
+    });
+    if (growing.size() > topn)
+        growing.resize(topn);
+    return growing;
+}
+
+std::vector<GrowthSite> growth_sites(size_t topn)
+{
+    return growth_detector().top_sites(topn);
+}
+
+int start_growth_detector(unsigned interval_sec, unsigned windows)
+{
+    return growth_detector().start(interval_sec, windows) ? 0 : -1;
+}
+
+void stop_growth_detector()
+{
+    growth_detector().stop();
+}
+
+int growth_detector_running()
+{
+    return growth_detector().running() ? 1 : 0;
+}
+
+void dump_growth_sites(unsigned topn)
+{
+    auto sites = growth_detector().top_sites(topn);
+    if (sites.empty())
+        fprintf(stderr, "no growing call site\n");
+    for (const auto& s : sites)
+        fprintf(stderr, "%s: +%zu bytes, %zu bytes in %zu allocations, mean age %.0f sec\n",
+                s.src.c_str(), s.growth, s.live_bytes, s.live_cnt, s.mean_age);
+}
@@ -0,0 +1,60 @@
+#ifndef __LEAK_DETECTOR_H__
+#define __LEAK_DETECTOR_H__
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "malloc.h"
+
+// A call site whose live bytes kept growing over the observed windows
+struct GrowthSite {
+    std::string src;    // source file:line
+    size_t live_cnt;    // live allocations at the last sample
+    size_t live_bytes;  // live bytes at the last sample
+    size_t growth;      // live bytes gained over the observed windows
+    double mean_age;    // mean age of the live allocations, in seconds
+};
+
+// Background analyzer of per call site live bytes.
+//
+// Every interval the detector samples the incremental per-site counters(the site
+// table, not the allocation table) and keeps the last `windows` samples of each
+// site. A site is flagged when its live bytes never decreased over all kept
+// samples and grew in total.
+class GrowthDetector {
+    public:
+        GrowthDetector(): _running(false), _interval(0), _windows(0) {}
+        ~GrowthDetector() { stop(); }
+
+        bool start(unsigned interval_sec, unsigned windows);
+        void stop();
+        bool running();
+
+        // Sites with monotonic growth, by growth in descending order
+        std::vector<GrowthSite> top_sites(size_t topn);
+
+    private:
+        void run();
+        void sample();
+
+        std::thread _thread;
+        std::mutex _mtx;
+        std::condition_variable _cond;
+        bool _running;
+        unsigned _interval;
+        unsigned _windows;
+        std::unordered_map<std::string,std::deque<size_t> > _history; // <file:line, live bytes per window>
+};
+
+// The detector behind the C API, constructed on first use. malloc.cc constructs it
+// during its static initialization and stops it before its own tables are destroyed.
+GrowthDetector& growth_detector();
+
+// Growing sites reported by the running detector
+std::vector<GrowthSite> growth_sites(size_t topn);
+
+#endif /*__LEAK_DETECTOR_H__*/
@@ -1,38 +1,114 @@
+#include <cinttypes>
 #include <cstdio>
 #include <cstring>
+#include <algorithm>
 #include <string>
 #include <vector>
+#include <mutex>
+#include <shared_mutex>
 #include <signal.h>
 #include "malloc.h"
 #include "my_malloc.h"
 #include "readwritelock.hh"
+#include "seqlock.hh"
+#include "leak_detector.h"
 
 Allocation allocs;  // current allocations
-OverallStat ovstat; // record overall stats
+OverallStat ovstat; // record overall stats, written with rwlck held
+SeqLock<OverallStat> ovstat_pub; // copy of ovstat for lock-free readers
+SiteTable sites;     // live allocations per call site
 ReadWriteLock rwlck;
 
+// The growth detector and stats exporter threads read the tables above. Statics of one
+// file are destroyed in reverse order, so this guard stops the threads before the tables
+// go away. The detector and exporter are constructed by the guard, hence destroyed after
+// it. The exporter stops first, as it reads the detector too.
+static struct Teardown {
+    Teardown() { growth_detector(); stats_exporter(); }
+    ~Teardown() { stop_stats_exporter(); stop_growth_detector(); }
+} teardown;
+
+OverallStat overall_stats()
+{
+    return ovstat_pub.load();
+}
+
+std::vector<std::pair<std::string,SiteStat> > site_stats()
+{
+    std::shared_lock<ReadWriteLock> lck(rwlck);
+    return std::vector<std::pair<std::string,SiteStat> >(sites.begin(), sites.end());
+}
+
 static inline std::string alloc_src(const char *file, int line)
 {
     return std::string(file) + ":" + std::to_string(line);
 }
 
+// Count allocations by memory size
+//0 - 4 bytes: ##########
+//4 - 8 bytes:
+//8 - 16 bytes: ####
+//16 - 32 bytes:
+//32 - 64 bytes:
+//64 - 128 bytes:
+//128 - 256 bytes:
+//256 - 512 bytes: ##
+//512 - 1024 bytes: #
+//1024 - 2048 bytes: #
+//2048 - 4096 bytes: #
+//4096 + bytes: #######
+static inline size_t size_bucket(size_t x)
+{
+    size_t i = 0, prod = 4;
+    if (x <= 4)
+        return i;
+    if (x >= 4096)
+        return MALLOC_STATS_SIZE_BUCKETS-1;
+    while(prod < x) {
+        prod = prod << 1;
+        i++;
+    }
+    return i;
+}
+
+// Account a live allocation to its call site. Called with rwlck held.
+static inline void site_add(AllocAttrib& attr)
+{
+    SiteStat& st = sites[attr.src]; // references into unordered_map are stable
+    st.live_cnt++;
+    st.live_bytes += attr.size;
+    st.ts_sum += attr.ts;
+    attr.site = &st;
+}
+
+// Remove a live allocation from its call site. Called with rwlck held.
+static inline void site_remove(const AllocAttrib& attr)
+{
+    if (!attr.site)
+        return;
+    attr.site->live_cnt--;
+    attr.site->live_bytes -= attr.size;
+    attr.site->ts_sum -= attr.ts;
+}
+
 void * my_malloc(const char *file, int line, size_t size, func_type_t func_id)
 {
-    rwlck.write_lock();
+    std::unique_lock<ReadWriteLock> lck(rwlck);
 
     void * ptr = (void*)new char[size];
-    if (!ptr) {
-        rwlck.write_unlock();
+    if (!ptr)
         return NULL;
-    }
 
     AllocAttrib attr(size, alloc_src(file,line), func_id);
+    site_add(attr);
     allocs[ptr] = attr;
 
     ovstat.alloc_cnt++;
     ovstat.alloc_size += size;
+    ovstat.curr_size += size;
+    ovstat.by_size[size_bucket(size)]++;
+    ovstat_pub.store(ovstat);
 
-    rwlck.write_unlock();
     return ptr;
 }
 
@@ -49,82 +125,57 @@ void * my_calloc(const char *file, int line, size_t num, size_t size, func_type_
 
 void * my_realloc(const char *file, int line, void *p, size_t size, func_type_t func_id)
 {
-    rwlck.write_lock();
+    std::unique_lock<ReadWriteLock> lck(rwlck);
 
     AllocAttrib attr;
-    if (allocs.count(p) > 0)
+    if (allocs.count(p) > 0) {
         attr = allocs[p];
+        site_remove(attr);
+        ovstat.by_size[size_bucket(attr.size)]--;
+        allocs.erase(p);
+    }
 
     delete [] (char*)p; // always free p first
     void * ptr = (void*)new char[size];
-    if (!ptr) {
-        rwlck.write_unlock();
+    if (!ptr)
         return NULL;
-    }
 
     // update overall stats
     ovstat.alloc_cnt++; // TODO: differentiate malloc and realloc
-    ovstat.alloc_size += (int)((int)size - (int)attr.size);
+    if (size >= attr.size) {
+        ovstat.alloc_size += size - attr.size;
+        ovstat.curr_size += size - attr.size;
+    } else {
+        ovstat.alloc_size -= attr.size - size;
+        ovstat.curr_size -= attr.size - size;
+    }
+    ovstat.by_size[size_bucket(size)]++;
+    ovstat_pub.store(ovstat);
 
     // update the stat of this allocation - keep timestamp unchanged
     attr.size = size;
     attr.src = alloc_src(file,line);
     attr.func = func_id;
+    site_add(attr);
     allocs[ptr] = attr;
 
-    rwlck.write_unlock();
     return ptr;
 }
 
 void my_free(const char *file, int line, void *p, func_type_t func_id)
 {
-    rwlck.write_lock();
+    std::unique_lock<ReadWriteLock> lck(rwlck);
 
     if (allocs.count(p) > 0) {
         ovstat.free_cnt++;
         ovstat.free_size += allocs[p].size;
+        ovstat.curr_size -= allocs[p].size;
+        ovstat.by_size[size_bucket(allocs[p].size)]--;
+        ovstat_pub.store(ovstat);
+        site_remove(allocs[p]);
         allocs.erase(p);
     }
     delete [] (char*)p;
-
-    rwlck.write_unlock();
-}
-
-static std::vector<size_t> curr_alloc_by_size()
-{
-    // Count allocations by memory size
-    //0 - 4 bytes: ##########
-    //4 - 8 bytes:
-    //8 - 16 bytes: ####
-    //16 - 32 bytes:
-    //32 - 64 bytes:
-    //64 - 128 bytes:
-    //128 - 256 bytes:
-    //256 - 512 bytes: ##
-    //512 - 1024 bytes: #
-    //1024 - 2048 bytes: #
-    //2048 - 4096 bytes: #
-    //4096 + bytes: #######
-    std::vector<size_t> stat(12, 0);
-    auto idx = [&](size_t x) -> size_t {
-        size_t i = 0, prod = 4;
-        if (x <= 4)
-            return i;
-        if (x >= 4096)
-            return stat.size()-1;
-        while(prod < x) {
-            prod = prod << 1;
-            i++;
-        }
-        return i;
-    };
-
-    rwlck.read_lock();
-    for (const auto& a : allocs)
-        stat[idx(a.second.size)]++;
-    rwlck.read_unlock();
-
-    return stat;
 }
 
 static std::vector<size_t> curr_alloc_by_age()
@@ -134,7 +185,8 @@ static std::vector<size_t> curr_alloc_by_age()
     //< 100 sec: ##
     //< 1000 sec: #########################
     //> 1000 sec:
-    std::vector<size_t> stat(5,0);
+    std::vector<size_t> stat(MALLOC_STATS_AGE_BUCKETS, 0);
+    time_t now = time(NULL);
     auto idx = [&](time_t end, time_t begin) -> size_t {
         int secs = (int)difftime(end, begin);
         if (secs < 1)
@@ -149,53 +201,112 @@ static std::vector<size_t> curr_alloc_by_age()
         return i;
     };
 
-    rwlck.read_lock();
+    std::shared_lock<ReadWriteLock> lck(rwlck);
     for (const auto& a : allocs)
-        stat[idx(a.second.ts, ovstat.epoch)]++;
-    rwlck.read_unlock();
+        stat[idx(now, a.second.ts)]++;
 
     return stat;
 }
 
-void dump_stats()
+int get_malloc_stats(malloc_stats_t *st)
 {
-    size_t curr_alloc_size = 0;
-    OverallStat tmpstat; // local copy of the overallstats
+    if (!st || st->version != MALLOC_STATS_VERSION || st->size != sizeof(malloc_stats_t))
+        return -1;
+    memset(st, 0, sizeof(malloc_stats_t));
+    st->version = MALLOC_STATS_VERSION;
+    st->size = sizeof(malloc_stats_t);
 
-    rwlck.read_lock();
-    tmpstat = ovstat;
-    for (const auto& a : allocs)
-        curr_alloc_size += a.second.size;
-    rwlck.read_unlock();
+    OverallStat tmpstat = overall_stats();
+    st->timestamp = time(NULL);
+    st->epoch = tmpstat.epoch;
+    st->alloc_cnt = tmpstat.alloc_cnt;
+    st->alloc_size = tmpstat.alloc_size;
+    st->free_cnt = tmpstat.free_cnt;
+    st->free_size = tmpstat.free_size;
+    st->curr_size = tmpstat.curr_size;
+    for (size_t i = 0; i < MALLOC_STATS_SIZE_BUCKETS; ++i)
+        st->by_size[i] = tmpstat.by_size[i];
+
+    auto by_age = curr_alloc_by_age();
+    for (size_t i = 0; i < MALLOC_STATS_AGE_BUCKETS; ++i)
+        st->by_age[i] = by_age[i];
+
+    // Top call sites by live bytes
+    auto top = site_stats();
+    size_t nsites = std::min(top.size(), (size_t)MALLOC_STATS_TOP_SITES);
+    std::partial_sort(top.begin(), top.begin() + nsites, top.end(),
+            [](const std::pair<std::string,SiteStat>& x, const std::pair<std::string,SiteStat>& y) {
+                return x.second.live_bytes > y.second.live_bytes;
+            });
+    std::unordered_map<std::string,size_t> growth;
+    for (const auto& g : growth_sites(top.size()))
+        growth[g.src] = g.growth;
+    for (size_t i = 0; i < nsites; ++i) {
+        malloc_site_stats_t& site = st->sites[i];
+        const SiteStat& sst = top[i].second;
+        if (!sst.live_cnt)
+            break;
+        snprintf(site.src, sizeof(site.src), "%s", top[i].first.c_str());
+        site.live_cnt = sst.live_cnt;
+        site.live_bytes = sst.live_bytes;
+        site.mean_age = difftime(st->timestamp, (time_t)(sst.ts_sum / sst.live_cnt));
+        auto it = growth.find(top[i].first);
+        if (it != growth.end())
+            site.growth = it->second;
+        st->nsites++;
+    }
+
+    return 0;
+}
 
-    time_t t = time(NULL);
+void dump_stats()
+{
+    malloc_stats_t st;
+    st.version = MALLOC_STATS_VERSION;
+    st.size = sizeof(st);
+    get_malloc_stats(&st);
+
+    time_t t = (time_t)st.timestamp;
     char* ptm = asctime(localtime(&t));
     std::string timestr = std::string(ptm);
     if (!timestr.empty() && timestr[timestr.length()-1] == '\n')
         timestr.erase(timestr.length()-1); // remove new line
     fprintf(stderr, ">>>>>>>>>>>>> %s <<<<<<<<<<<\n", timestr.c_str());
     fprintf(stderr, "Overall stats:\n");
-    fprintf(stderr, "%u overall allocations(%u MB) since start\n", tmpstat.alloc_cnt, tmpstat.alloc_size/(1024*1024));
-    fprintf(stderr, "%u MB current total allocated size\n", curr_alloc_size/(1024*1024));
+    fprintf(stderr, "%" PRIu64 " overall allocations(%" PRIu64 " MB) since start\n", st.alloc_cnt, st.alloc_size/(1024*1024));
+    fprintf(stderr, "%" PRIu64 " MB current total allocated size\n", st.curr_size/(1024*1024));
 
     fprintf(stderr, "\nCurrent allocations by size:\n");
-    auto alloc_stats = curr_alloc_by_size();
     int prod = 4;
-    fprintf(stderr, "%d - %d bytes: %u\n", 0, prod, alloc_stats[0]);
+    fprintf(stderr, "%d - %d bytes: %" PRIu64 "\n", 0, prod, st.by_size[0]);
     size_t idx;
-    for (idx = 1; idx < alloc_stats.size()-1; ++idx) {
-        fprintf(stderr, "%d - %d bytes: %u\n", prod << idx-1, prod << idx, alloc_stats[idx]);
+    for (idx = 1; idx < MALLOC_STATS_SIZE_BUCKETS-1; ++idx) {
+        fprintf(stderr, "%d - %d bytes: %" PRIu64 "\n", prod << (idx-1), prod << idx, st.by_size[idx]);
     }
-    fprintf(stderr, "%d + bytes: %u\n", prod << (idx-1), alloc_stats[idx]);
+    fprintf(stderr, "%d + bytes: %" PRIu64 "\n", prod << (idx-1), st.by_size[idx]);
 
     fprintf(stderr,"\nCurrent allocations by age:\n");
-    alloc_stats = curr_alloc_by_age();
     prod = 1;
-    for (idx = 0; idx < alloc_stats.size()-1; ++idx) {
-        fprintf(stderr, "< %d sec: %u\n", prod, alloc_stats[idx]);
+    for (idx = 0; idx < MALLOC_STATS_AGE_BUCKETS-1; ++idx) {
+        fprintf(stderr, "< %d sec: %" PRIu64 "\n", prod, st.by_age[idx]);
         prod *= 10;
     }
-    fprintf(stderr, "> %d sec: %u\n", prod, alloc_stats[idx]);
+    fprintf(stderr, ">= %d sec: %" PRIu64 "\n", prod/10, st.by_age[idx]);
+
+    if (growth_detector_running()) {
+        fprintf(stderr, "\nTop growing call sites:\n");
+        dump_growth_sites(10);
+    }
+
+    // Lock contention of the allocation table
+    LockStats lst = rwlck.stats();
+    fprintf(stderr, "\nLock contention:\n");
+    fprintf(stderr, "write: %" PRIu64 " acquired, %" PRIu64 " contended, %" PRIu64 " us waited (max %" PRIu64 " us), %" PRIu64 " us held (max %" PRIu64 " us)\n",
+            lst.write_acquired, lst.write_contended, lst.write_wait_ns/1000, lst.write_wait_max_ns/1000,
+            lst.write_held_ns/1000, lst.write_held_max_ns/1000);
+    fprintf(stderr, "read: %" PRIu64 " acquired, %" PRIu64 " contended, %" PRIu64 " us waited (max %" PRIu64 " us), %" PRIu64 " us held\n",
+            lst.read_acquired, lst.read_contended, lst.read_wait_ns/1000, lst.read_wait_max_ns/1000,
+            lst.read_held_ns/1000);
 }
 
 void sig_quit_handler(int sig)
@@ -5,6 +5,8 @@
 #include <cstdlib>
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 #include "my_malloc.h"
 
 // Required Stats:
@@ -13,15 +15,27 @@
 //  - current allocation by size
 //  - current allocatioj by age
 
+// Live allocations of one call site, updated on every malloc/realloc/free
+// so that per-site totals never require walking the allocation table.
+struct SiteStat {
+    size_t live_cnt;    // number of live allocations
+    size_t live_bytes;  // live allocated size
+    double ts_sum;      // sum of the timestamps of live allocations
+
+    SiteStat(): live_cnt(0), live_bytes(0), ts_sum(0) {}
+};
+typedef std::unordered_map<std::string,SiteStat> SiteTable; // <file:line, stats>
+
 // Memory allocation attribution
 struct AllocAttrib {
     size_t size;        // in bytes
     time_t ts;     // timestamp
     std::string src;    // source file:line
     func_type_t func;   // function type
+    SiteStat *site;     // entry of src in the site table
 
     AllocAttrib(size_t sz=0, std::string source="", func_type_t fid=MALLOC_FUNC_UNKNOWN):
-        size(sz),src(source), func(fid) {
+        size(sz),src(source), func(fid), site(nullptr) {
         ts = std::time(nullptr);
     }
 };
@@ -32,6 +46,8 @@ struct OverallStat {
     size_t alloc_size;  // allocated memory size
     size_t free_cnt;    // number of frees
     size_t free_size;   // freed memory size
+    size_t curr_size;   // currently allocated memory size
+    size_t by_size[MALLOC_STATS_SIZE_BUCKETS]; // live allocations by size
     std::time_t epoch;  // start time stamp
 
     OverallStat() {
@@ -39,8 +55,21 @@ struct OverallStat {
         alloc_size = 0;
         free_cnt = 0;
         free_size = 0;
+        curr_size = 0;
+        for (size_t i = 0; i < MALLOC_STATS_SIZE_BUCKETS; ++i)
+            by_size[i] = 0;
         epoch = std::time(nullptr);
     }
 };
 
+// Consistent copy of the overall stats. Lock-free, never blocks allocations.
+OverallStat overall_stats();
+
+// Copy of the per call site stats
+std::vector<std::pair<std::string,SiteStat> > site_stats();
+
+// The exporter behind the C API, constructed on first use(see exporter.cc)
+class StatsExporter;
+StatsExporter& stats_exporter();
+
 #endif /*__MALLOC_H__*/
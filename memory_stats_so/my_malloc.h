@@ -5,6 +5,9 @@
 #define DLL_PUBLIC __attribute__ ((visibility("default")))
 #endif
 
+#include <stddef.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -24,6 +27,67 @@ void * my_realloc(const char *file, int line, void *p, size_t size, func_type_t
 void my_free(const char *file, int line, void *p, func_type_t func_id);
 void dump_stats();
 
+// Leak detection: sample the live bytes of every call site each interval_sec
+// seconds, and report the sites which kept growing over the last `windows`
+// samples. start_growth_detector returns 0 on success, -1 otherwise.
+int start_growth_detector(unsigned interval_sec, unsigned windows);
+void stop_growth_detector();
+int growth_detector_running();
+void dump_growth_sites(unsigned topn);
+
+// Programmatic snapshot of the stats.
+//
+// The caller sets `version` to MALLOC_STATS_VERSION and `size` to
+// sizeof(malloc_stats_t) before calling get_malloc_stats(), which returns 0 on
+// success and -1 if the library does not support the requested layout.
+#define MALLOC_STATS_VERSION        1
+#define MALLOC_STATS_SIZE_BUCKETS   12  // 0-4, 4-8, ..., 2048-4096, 4096+ bytes
+#define MALLOC_STATS_AGE_BUCKETS    5   // <1, <10, <100, <1000, >=1000 sec
+#define MALLOC_STATS_TOP_SITES      16
+#define MALLOC_STATS_SRC_LEN        120
+
+typedef struct {
+    char src[MALLOC_STATS_SRC_LEN]; // source file:line, truncated
+    uint64_t live_cnt;      // live allocations
+    uint64_t live_bytes;    // live allocated size
+    uint64_t growth;        // bytes gained over the leak detector windows, 0 if not growing
+    double mean_age;        // mean age of the live allocations, in seconds
+} malloc_site_stats_t;
+
+typedef struct {
+    uint32_t version;       // MALLOC_STATS_VERSION
+    uint32_t size;          // sizeof(malloc_stats_t)
+    int64_t timestamp;      // time of the snapshot
+    int64_t epoch;          // start time stamp
+    uint64_t alloc_cnt;     // number of allocations since start
+    uint64_t alloc_size;    // allocated memory size since start
+    uint64_t free_cnt;      // number of frees since start
+    uint64_t free_size;     // freed memory size since start
+    uint64_t curr_size;     // currently allocated memory size
+    uint64_t by_size[MALLOC_STATS_SIZE_BUCKETS];    // live allocations by size
+    uint64_t by_age[MALLOC_STATS_AGE_BUCKETS];      // live allocations by age
+    uint32_t nsites;        // valid entries in sites
+    uint32_t reserved;
+    malloc_site_stats_t sites[MALLOC_STATS_TOP_SITES]; // call sites by live bytes
+} malloc_stats_t;
+
+int get_malloc_stats(malloc_stats_t *st);
+
+// Format a snapshot as a single line JSON object. Returns the length of the
+// object like snprintf(), output is truncated if it does not fit in len bytes.
+int format_malloc_stats_json(const malloc_stats_t *st, char *buf, size_t len);
+
+typedef enum {
+    MALLOC_EXPORT_JSON = 0, // one JSON object per snapshot
+    MALLOC_EXPORT_BINARY    // raw malloc_stats_t
+} export_format_t;
+
+// Export a snapshot every interval_ms milliseconds. `dest` is either a file
+// path, replaced atomically on every export, or "unix:<path>" to send each
+// snapshot as one datagram to a unix domain socket. Returns 0 on success.
+int start_stats_exporter(const char *dest, unsigned interval_ms, export_format_t fmt);
+void stop_stats_exporter();
+
 #undef malloc
 #define malloc(size) \
     my_malloc(__FILE__, __LINE__, (size), MALLOC_FUNC_MALLOC)
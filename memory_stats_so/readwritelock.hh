@@ -1,31 +1,76 @@
 #ifndef __READ_WRITE_LOCK_HH__
 #define __READ_WRITE_LOCK_HH__
 
+#include <cstdint>
+#include <chrono>
 #include <mutex>
 #include <condition_variable>
 
+// Contention counters of a ReadWriteLock. Times are in nanoseconds.
+struct LockStats {
+    uint64_t read_acquired;     // shared acquisitions
+    uint64_t read_contended;    // shared acquisitions which had to wait
+    uint64_t read_wait_ns;      // total time spent waiting for shared access
+    uint64_t read_wait_max_ns;  // longest wait for shared access
+    uint64_t read_held_ns;      // total time the lock was held by >= 1 reader
+    uint64_t write_acquired;    // exclusive acquisitions
+    uint64_t write_contended;   // exclusive acquisitions which had to wait
+    uint64_t write_wait_ns;     // total time spent waiting for exclusive access
+    uint64_t write_wait_max_ns; // longest wait for exclusive access
+    uint64_t write_held_ns;     // total time the lock was held by a writer
+    uint64_t write_held_max_ns; // longest exclusive hold
+    uint64_t timeouts;          // try_lock*_for/until calls that gave up
+
+    LockStats() {
+        read_acquired = read_contended = read_wait_ns = read_wait_max_ns = read_held_ns = 0;
+        write_acquired = write_contended = write_wait_ns = write_wait_max_ns = 0;
+        write_held_ns = write_held_max_ns = 0;
+        timeouts = 0;
+    }
+};
+
 // A write-preference Read-Write lock
+//
+// Besides read_lock()/write_lock(), the lock satisfies the standard
+// SharedTimedLockable requirements, so it can be used with std::unique_lock,
+// std::shared_lock and std::lock_guard:
+//
+//      std::unique_lock<ReadWriteLock> wlck(rwlck);    // exclusive
+//      std::shared_lock<ReadWriteLock> rlck(rwlck, std::chrono::milliseconds(5));
+//      if (!rlck.owns_lock())
+//          return; // lock is busy, back off
+//
+// Wait and hold times are recorded on every acquisition, see stats().
 class ReadWriteLock {
     public:
+        typedef std::chrono::steady_clock clock;
+
         ReadWriteLock() {
             _nread = _nread_waiters = 0;
             _nwrite = _nwrite_waiters = 0;
         }
 
+        ReadWriteLock(const ReadWriteLock&) = delete;
+        ReadWriteLock& operator=(const ReadWriteLock&) = delete;
+
         void read_lock() {
             std::unique_lock<std::mutex> lck(_mtx);
             if (_nwrite || _nwrite_waiters) {
+                clock::time_point start = clock::now();
                 _nread_waiters++;
                 while (_nwrite || _nwrite_waiters)
                     _rcond.wait(lck); // calls lck.unlock() inherently, lck.lock() is called after notified.
                 _nread_waiters--;
+                read_waited(start);
             }
-            _nread++;
+            read_acquired();
         }
 
         void read_unlock() {
             std::unique_lock<std::mutex> lck(_mtx);
             _nread--;
+            if (!_nread)
+                _stats.read_held_ns += elapsed_ns(_read_since);
             if (_nwrite_waiters)
                 _wcond.notify_all();
         }
@@ -33,29 +78,174 @@ class ReadWriteLock {
         void write_lock() {
             std::unique_lock<std::mutex> lck(_mtx);
             if (_nread || _nwrite) {
+                clock::time_point start = clock::now();
                 _nwrite_waiters++;
                 while (_nread || _nwrite)
                     _wcond.wait(lck);
                 _nwrite_waiters--;
+                write_waited(start);
             }
-            _nwrite++;
+            write_acquired();
         }
 
         void write_unlock() {
             std::unique_lock<std::mutex> lck(_mtx);
             _nwrite--;
+            uint64_t held = elapsed_ns(_write_since);
+            _stats.write_held_ns += held;
+            if (held > _stats.write_held_max_ns)
+                _stats.write_held_max_ns = held;
             if (_nwrite_waiters) // write-preference
                 _wcond.notify_all();
             else if (_nread_waiters)
                 _rcond.notify_all();
         }
 
+        bool try_read_lock() {
+            std::unique_lock<std::mutex> lck(_mtx);
+            if (_nwrite || _nwrite_waiters)
+                return false;
+            read_acquired();
+            return true;
+        }
+
+        bool try_write_lock() {
+            std::unique_lock<std::mutex> lck(_mtx);
+            if (_nread || _nwrite)
+                return false;
+            write_acquired();
+            return true;
+        }
+
+        template <class Clock, class Duration>
+        bool try_read_lock_until(const std::chrono::time_point<Clock, Duration>& deadline) {
+            std::unique_lock<std::mutex> lck(_mtx);
+            if (_nwrite || _nwrite_waiters) {
+                clock::time_point start = clock::now();
+                _nread_waiters++;
+                bool ok = _rcond.wait_until(lck, deadline, [this] { return !_nwrite && !_nwrite_waiters; });
+                _nread_waiters--;
+                if (!ok) {
+                    _stats.timeouts++;
+                    return false;
+                }
+                read_waited(start);
+            }
+            read_acquired();
+            return true;
+        }
+
+        template <class Clock, class Duration>
+        bool try_write_lock_until(const std::chrono::time_point<Clock, Duration>& deadline) {
+            std::unique_lock<std::mutex> lck(_mtx);
+            if (_nread || _nwrite) {
+                clock::time_point start = clock::now();
+                _nwrite_waiters++;
+                bool ok = _wcond.wait_until(lck, deadline, [this] { return !_nread && !_nwrite; });
+                _nwrite_waiters--;
+                if (!ok) {
+                    _stats.timeouts++;
+                    // readers may be parked behind this writer
+                    if (!_nwrite_waiters && !_nwrite && _nread_waiters)
+                        _rcond.notify_all();
+                    return false;
+                }
+                write_waited(start);
+            }
+            write_acquired();
+            return true;
+        }
+
+        template <class Rep, class Period>
+        bool try_read_lock_for(const std::chrono::duration<Rep, Period>& timeout) {
+            return try_read_lock_until(clock::now() + timeout);
+        }
+
+        template <class Rep, class Period>
+        bool try_write_lock_for(const std::chrono::duration<Rep, Period>& timeout) {
+            return try_write_lock_until(clock::now() + timeout);
+        }
+
+        // Lockable/TimedLockable
+        void lock() { write_lock(); }
+        void unlock() { write_unlock(); }
+        bool try_lock() { return try_write_lock(); }
+        template <class Rep, class Period>
+        bool try_lock_for(const std::chrono::duration<Rep, Period>& timeout) {
+            return try_write_lock_for(timeout);
+        }
+        template <class Clock, class Duration>
+        bool try_lock_until(const std::chrono::time_point<Clock, Duration>& deadline) {
+            return try_write_lock_until(deadline);
+        }
+
+        // SharedLockable/SharedTimedLockable
+        void lock_shared() { read_lock(); }
+        void unlock_shared() { read_unlock(); }
+        bool try_lock_shared() { return try_read_lock(); }
+        template <class Rep, class Period>
+        bool try_lock_shared_for(const std::chrono::duration<Rep, Period>& timeout) {
+            return try_read_lock_for(timeout);
+        }
+        template <class Clock, class Duration>
+        bool try_lock_shared_until(const std::chrono::time_point<Clock, Duration>& deadline) {
+            return try_read_lock_until(deadline);
+        }
+
+        // Snapshot of the contention counters
+        LockStats stats() {
+            std::unique_lock<std::mutex> lck(_mtx);
+            return _stats;
+        }
+
+        void reset_stats() {
+            std::unique_lock<std::mutex> lck(_mtx);
+            _stats = LockStats();
+        }
+
     private:
+        static uint64_t elapsed_ns(clock::time_point since) {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - since).count();
+        }
+
+        // The helpers below are called with _mtx held
+        void read_waited(clock::time_point start) {
+            uint64_t waited = elapsed_ns(start);
+            _stats.read_contended++;
+            _stats.read_wait_ns += waited;
+            if (waited > _stats.read_wait_max_ns)
+                _stats.read_wait_max_ns = waited;
+        }
+
+        void read_acquired() {
+            if (!_nread)
+                _read_since = clock::now();
+            _nread++;
+            _stats.read_acquired++;
+        }
+
+        void write_waited(clock::time_point start) {
+            uint64_t waited = elapsed_ns(start);
+            _stats.write_contended++;
+            _stats.write_wait_ns += waited;
+            if (waited > _stats.write_wait_max_ns)
+                _stats.write_wait_max_ns = waited;
+        }
+
+        void write_acquired() {
+            _nwrite++;
+            _write_since = clock::now();
+            _stats.write_acquired++;
+        }
+
         std::mutex _mtx;
         std::condition_variable _rcond;
         std::condition_variable _wcond;
         uint32_t _nread, _nread_waiters;
         uint32_t _nwrite, _nwrite_waiters;
+        clock::time_point _read_since;  // when the first current reader got the lock
+        clock::time_point _write_since; // when the current writer got the lock
+        LockStats _stats;
 };
 
 #endif //__READ_WRITE_LOCK_HH__
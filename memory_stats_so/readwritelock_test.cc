@@ -5,6 +5,8 @@
 #include <chrono>
 #include <cstdlib>
 #include <ctime>
+#include <mutex>
+#include <shared_mutex>
 #include "readwritelock.hh"
 
 ReadWriteLock rwlck;
@@ -65,6 +67,27 @@ void watcher() {
     }
 }
 
+// Reporter backs off when the lock is busy instead of queueing behind writers
+void reporter() {
+    size_t backoffs = 0;
+    while (true) {
+        std::shared_lock<ReadWriteLock> lck(rwlck, std::chrono::microseconds(100));
+        if (!lck.owns_lock()) {
+            backoffs++;
+            std::this_thread::sleep_for (std::chrono::milliseconds(1));
+            continue;
+        }
+        bool iamdone = (total_cargo >= max_cargo) && cargo.empty();
+        lck.unlock();
+
+        if (iamdone)
+            break;
+
+        std::this_thread::sleep_for (std::chrono::milliseconds(rand()%8+1));
+    }
+    std::cout << std::this_thread::get_id() << ": reporter backed off " << backoffs << " times" << std::endl;
+}
+
 int main()
 {
     srand(time(NULL));
@@ -72,6 +95,7 @@ int main()
     const int cons_threads = 3;
     const int watch_threads = 2;
     std::vector<std::thread> consumers, producers, watchers;
+    std::thread report(reporter);
     for (int i = 0; i < prod_threads; ++i)
         producers.push_back(std::thread(producer, i*max_cargo/prod_threads, max_cargo/prod_threads));
     for (int i = 0; i < cons_threads; ++i)
@@ -85,4 +109,12 @@ int main()
         consumers[i].join();
     for (int i = 0; i < watch_threads; ++i)
         watchers[i].join();
+    report.join();
+
+    LockStats lst = rwlck.stats();
+    std::cout << "write: " << lst.write_acquired << " acquired, " << lst.write_contended << " contended, "
+        << lst.write_wait_ns/1000 << " us waited, " << lst.write_held_ns/1000 << " us held" << std::endl;
+    std::cout << "read: " << lst.read_acquired << " acquired, " << lst.read_contended << " contended, "
+        << lst.read_wait_ns/1000 << " us waited, " << lst.read_held_ns/1000 << " us held" << std::endl;
+    std::cout << "timeouts: " << lst.timeouts << std::endl;
 }
@@ -0,0 +1,70 @@
+#ifndef __SEQ_LOCK_HH__
+#define __SEQ_LOCK_HH__
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// A sequence lock publishing a trivially copyable value to lock-free readers.
+//
+// Writers must be serialized externally(e.g. by holding the write lock of the
+// allocation table). Readers never block the writer: they copy the value and
+// retry if a write happened in between. The value is stored as an array of
+// atomic words so that concurrent copies are free of data races.
+template <typename T>
+class SeqLock {
+    static_assert(std::is_trivially_copyable<T>::value, "SeqLock requires a trivially copyable type");
+
+    public:
+        SeqLock() : _seq(0) {
+            T init = T();
+            store(init);
+        }
+
+        SeqLock(const SeqLock&) = delete;
+        SeqLock& operator=(const SeqLock&) = delete;
+
+        // Publish a new value. Not safe against concurrent writers.
+        void store(const T& val) {
+            uint64_t words[NWORDS] = {0};
+            memcpy(words, &val, sizeof(T));
+
+            uint64_t seq = _seq.load(std::memory_order_relaxed);
+            _seq.store(seq + 1, std::memory_order_relaxed); // odd: write in progress
+            std::atomic_thread_fence(std::memory_order_release);
+            for (size_t i = 0; i < NWORDS; ++i)
+                _data[i].store(words[i], std::memory_order_relaxed);
+            _seq.store(seq + 2, std::memory_order_release);
+        }
+
+        // Read a consistent copy of the value, spinning while a write is in progress.
+        T load() const {
+            uint64_t words[NWORDS];
+            uint64_t seq0, seq1;
+            do {
+                seq0 = _seq.load(std::memory_order_acquire);
+                for (size_t i = 0; i < NWORDS; ++i)
+                    words[i] = _data[i].load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                seq1 = _seq.load(std::memory_order_relaxed);
+            } while ((seq0 & 1) || seq0 != seq1);
+
+            T val;
+            memcpy(&val, words, sizeof(T));
+            return val;
+        }
+
+        // Number of values published so far
+        uint64_t version() const {
+            return _seq.load(std::memory_order_acquire) >> 1;
+        }
+
+    private:
+        static const size_t NWORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+        std::atomic<uint64_t> _seq;
+        std::atomic<uint64_t> _data[NWORDS];
+};
+
+#endif //__SEQ_LOCK_HH__
@@ -61,6 +61,11 @@ int main()
         exit(1);
     }
 
+    // flag call sites growing over the last 6 samples, taken every 5 seconds
+    start_growth_detector(5, 6);
+    // machine-readable snapshot for monitoring agents, refreshed every second
+    start_stats_exporter("my_malloc_stats.json", 1000, MALLOC_EXPORT_JSON);
+
     const int nthreads = 3;
     std::list<std::thread> thread_alloc, thread_free;
     for (int i = 0; i < nthreads; ++i) {
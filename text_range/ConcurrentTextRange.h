@@ -0,0 +1,203 @@
+#ifndef _CONCURRENT_TEXT_RANGE_H_
+#define _CONCURRENT_TEXT_RANGE_H_
+
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include "TextRange.h"
+
+// Epoch based reclamation shared by all ConcurrentTextRanges.
+//
+// Every reader thread owns one slot, where it announces the global epoch while it
+// is reading. A writer retires the old version with the epoch at the time it was
+// unpublished, and frees it once no slot announces that epoch or an older one.
+class EpochDomain {
+public:
+	static const int kMaxReaders=256;	// reader threads alive at the same time
+
+	static EpochDomain& Global() {
+		static EpochDomain domain;
+		return domain;
+	}
+
+	// Called by readers, may nest within one thread
+	void Enter();
+	void Exit();
+
+	// Called by writers: advance the global epoch, returning the epoch before it
+	uint64_t Advance() {return epoch.fetch_add(1);}
+	// Oldest epoch announced by a reader, UINT64_MAX if there is no reader
+	uint64_t MinActive() const;
+
+private:
+	struct Slot {
+		atomic<uint64_t> epoch{0};	// 0 if not reading
+		atomic<bool> used{false};
+		char pad[64-sizeof(atomic<uint64_t>)-sizeof(atomic<bool>)];	// one slot per cache line
+	};
+
+	// Slot of the calling thread, released when the thread exits
+	struct ThreadSlot {
+		Slot* slot=nullptr;
+		int depth=0;
+		~ThreadSlot() {
+			if(slot)
+				slot->used.store(false);
+		}
+	};
+
+	EpochDomain() {}
+	ThreadSlot& Claim();
+
+	atomic<uint64_t> epoch{1};
+	Slot slots[kMaxReaders];
+};
+
+inline EpochDomain::ThreadSlot& EpochDomain::Claim() {
+	static thread_local ThreadSlot ts;
+	if(ts.slot)
+		return ts;
+	for(int i=0;i<kMaxReaders;++i) {
+		bool expected=false;
+		if(!slots[i].used.load(memory_order_relaxed) && slots[i].used.compare_exchange_strong(expected,true)) {
+			ts.slot=&slots[i];
+			return ts;
+		}
+	}
+	throw runtime_error("EpochDomain: too many reader threads");
+}
+
+// The announcement is sequentially consistent with the following load of the
+// published pointer, so a writer scanning the slots after unpublishing either
+// sees this reader, or the reader sees the new version.
+inline void EpochDomain::Enter() {
+	ThreadSlot& ts=Claim();
+	if(ts.depth++==0)
+		ts.slot->epoch.store(epoch.load());
+}
+
+inline void EpochDomain::Exit() {
+	ThreadSlot& ts=Claim();
+	if(--ts.depth==0)
+		ts.slot->epoch.store(0,memory_order_release);
+}
+
+inline uint64_t EpochDomain::MinActive() const {
+	uint64_t min_epoch=UINT64_MAX;
+	for(int i=0;i<kMaxReaders;++i) {
+		uint64_t e=slots[i].epoch.load();
+		if(e && e<min_epoch)
+			min_epoch=e;
+	}
+	return min_epoch;
+}
+
+// A TextRange read from many threads and updated occasionally.
+//
+// Readers never block: they pin the current version with a ReadGuard and query
+// it like any TextRange. Writers are serialized; each update copies the current
+// version, modifies the copy and publishes it atomically. Old versions are freed
+// by the writers once all readers which could still see them are gone.
+//
+// 		ConcurrentTextRange rng(TextRange("[a-c]"));
+// 		rng+=TextRange("[x-z]");	// control thread
+// 		rng.InRange("b");	// any thread
+// 		{
+// 			auto snap=rng.Snapshot();	// several queries on one version
+// 			snap->InRange("b") && snap->InRange("y");
+// 		}
+class ConcurrentTextRange {
+public:
+	// Pins the version published when it was created
+	class ReadGuard {
+	public:
+		explicit ReadGuard(const ConcurrentTextRange& crng): domain(crng.domain) {
+			domain.Enter();
+			rng=crng.current.load();
+		}
+		~ReadGuard() {domain.Exit();}
+		ReadGuard(const ReadGuard&)=delete;
+		ReadGuard& operator=(const ReadGuard&)=delete;
+
+		const TextRange& operator*() const {return *rng;}
+		const TextRange* operator->() const {return rng;}
+
+	private:
+		EpochDomain& domain;
+		const TextRange* rng;
+	};
+
+	ConcurrentTextRange(): ConcurrentTextRange(TextRange()) {}
+	explicit ConcurrentTextRange(TextRange rng): domain(EpochDomain::Global()), current(new TextRange(std::move(rng))) {}
+	ConcurrentTextRange(const ConcurrentTextRange&)=delete;
+	ConcurrentTextRange& operator=(const ConcurrentTextRange&)=delete;
+	~ConcurrentTextRange();	// no reader may be left
+
+	ReadGuard Snapshot() const {return ReadGuard(*this);}
+	bool InRange(string_view key) const {return Snapshot()->InRange(key);}
+	bool InRange(const string& key) const {return InRange(string_view(key));}
+	bool InRange(const char* key) const {return InRange(string_view(key));}
+	TextRange Load() const {return *Snapshot();}	// copy of the current version
+
+	// Updates
+	void Store(TextRange rng);
+	template<typename F> void Update(F&& modify);	// modify(TextRange&) a copy of the current version
+	ConcurrentTextRange& operator+=(const TextRange& rng) {Update([&](TextRange& cur) {cur+=rng;}); return *this;}
+	ConcurrentTextRange& operator+=(const Range& rng) {Update([&](TextRange& cur) {cur+=rng;}); return *this;}
+	ConcurrentTextRange& operator-=(const TextRange& rng) {Update([&](TextRange& cur) {cur-=rng;}); return *this;}
+	ConcurrentTextRange& operator-=(const Range& rng) {Update([&](TextRange& cur) {cur-=rng;}); return *this;}
+
+private:
+	void Publish(TextRange* next);	// called with wlock held
+	void Reclaim();	// called with wlock held
+
+	EpochDomain& domain;
+	atomic<const TextRange*> current;
+	mutex wlock;	// serializes writers
+	vector<pair<uint64_t,const TextRange*> > retired;	// <epoch when unpublished, version>
+};
+
+inline ConcurrentTextRange::~ConcurrentTextRange() {
+	delete current.load();
+	for(auto& r:retired)
+		delete r.second;
+}
+
+inline void ConcurrentTextRange::Store(TextRange rng) {
+	lock_guard<mutex> lck(wlock);
+	Publish(new TextRange(std::move(rng)));
+}
+
+template<typename F>
+void ConcurrentTextRange::Update(F&& modify) {
+	lock_guard<mutex> lck(wlock);
+	TextRange* next=new TextRange(*current.load());
+	try {
+		modify(*next);
+	} catch(...) {
+		delete next;
+		throw;
+	}
+	Publish(next);
+}
+
+inline void ConcurrentTextRange::Publish(TextRange* next) {
+	const TextRange* old=current.exchange(next);
+	retired.push_back(make_pair(domain.Advance(),old));
+	Reclaim();
+}
+
+// Readers which may still use a version announced its retire epoch or an older one
+inline void ConcurrentTextRange::Reclaim() {
+	uint64_t min_epoch=domain.MinActive();
+	size_t kept=0;
+	for(size_t i=0;i<retired.size();++i) {
+		if(retired[i].first<min_epoch)
+			delete retired[i].second;
+		else
+			retired[kept++]=retired[i];
+	}
+	retired.resize(kept);
+}
+
+#endif
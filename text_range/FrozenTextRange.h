@@ -0,0 +1,384 @@
+#ifndef _FROZEN_TEXT_RANGE_H_
+#define _FROZEN_TEXT_RANGE_H_
+
+#include <memory>
+#include <stdexcept>
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "TextRange.h"
+
+// Immutable, compact form of a TextRange.
+//
+// All boundaries(lower0, upper0, lower1, upper1, ...) are sorted, so they are
+// stored front-compressed in one contiguous arena: each boundary only keeps the
+// bytes which differ from the previous one. Every `interval` boundaries, a
+// restart boundary is stored in full and its offset is kept in a fixed-width
+// array, so that lookups binary search the restarts and decode one block only.
+// The inclusion flags of both sides of every range are packed into bits.
+//
+// Image layout(host byte order):
+// 		Header
+// 		uint32_t restarts[nrestarts]	// arena offsets of the restart boundaries
+// 		padding to 8 bytes
+// 		uint64_t flags[(2*nranges+63)/64]	// bit 2i: '[' of range i, bit 2i+1: ']' of range i
+// 		arena: for each boundary, varint shared, varint unshared, unshared bytes
+//
+// The image is the serialized form as is, and copies of a FrozenTextRange share it.
+// Saved images are queried in place through a read-only shared mapping, so any
+// number of processes opening the same file share one copy in the page cache.
+class FrozenTextRange {
+public:
+	struct Header {
+		uint32_t magic;	// kMagic
+		uint32_t version;	// kVersion
+		uint32_t nranges;	// number of ranges
+		uint32_t interval;	// boundaries per restart, even
+		uint32_t nrestarts;	// number of restarts
+		uint32_t byte_order;	// kByteOrder as written by the host
+		uint64_t arena_size;	// bytes of the arena
+	};
+
+	static const uint32_t kMagic=0x31525446;	// "FTR1"
+	static const uint32_t kVersion=1;
+	static const uint32_t kByteOrder=0x01020304;
+
+	FrozenTextRange();
+	// Throws runtime_error if a restart would lie past 4 GB of boundaries
+	explicit FrozenTextRange(const TextRange& rng, uint32_t interval=16);
+
+	bool InRange(string_view key) const;	// Query on whether a string is inside the ranges
+	int GetRangeNum() const {return Head().nranges;}
+	Range GetRange(int idx) const;	// Decode a range by index
+	TextRange Thaw() const;	// Convert back to a mutable TextRange
+	size_t MemoryUsage() const {return size;}	// bytes of the image
+
+	string Serialize() const {return string(base,size);}
+	static FrozenTextRange Deserialize(string data);	// throws runtime_error if data is invalid
+
+	// Persistence. Open() maps the file and validates it, reading the boundaries
+	// once, but no copy is made. Both throw runtime_error on failure.
+	void Save(const string& path) const;
+	static FrozenTextRange Open(const string& path);
+
+private:
+	const Header& Head() const {return *reinterpret_cast<const Header*>(base);}
+	const uint32_t* Restarts() const {return reinterpret_cast<const uint32_t*>(base+sizeof(Header));}
+	const uint64_t* Flags() const;
+	const unsigned char* Arena() const;
+	bool Inclusive(size_t bound) const {return (Flags()[bound/64]>>(bound%64))&1;}
+
+	// Decode the boundary at p following `prev`, which is updated in place
+	static const unsigned char* Decode(const unsigned char* p, string& prev);
+	static string_view RestartKey(const unsigned char* p);
+	static const unsigned char* GetVarint(const unsigned char* p, uint64_t& val);
+	static void PutVarint(string& out, uint64_t val);
+	static size_t FlagsOffset(uint32_t nrestarts);
+	void Validate() const;
+
+	shared_ptr<const void> owner;	// keeps the image(a string or a mapping) alive
+	const char* base;	// start of the image
+	size_t size;	// size of the image
+};
+
+inline FrozenTextRange::FrozenTextRange() {
+	string img(sizeof(Header),'\0');
+	Header h={kMagic,kVersion,0,16,0,kByteOrder,0};
+	memcpy(&img[0],&h,sizeof(h));
+	auto buf=make_shared<const string>(std::move(img));
+	base=buf->data();
+	size=buf->size();
+	owner=buf;
+}
+
+// Freeze a TextRange. Its ranges are sorted and disjoint already.
+inline FrozenTextRange::FrozenTextRange(const TextRange& rng, uint32_t interval) {
+	if(interval<2)
+		interval=2;
+	interval+=interval%2;	// a range never spans two blocks
+
+	uint32_t nranges=rng.GetRangeNum();
+	vector<uint32_t> restarts;
+	vector<uint64_t> flags((2*(size_t)nranges+63)/64,0);
+	string arena;
+	const string* prev=nullptr;
+	size_t bound=0;
+	for(const Range& r:rng.GetRange()) {
+		const string* sides[2]={&r.lower,&r.upper};
+		bool incl[2]={r.linc=='[',r.rinc==']'};
+		for(int s=0;s<2;++s,++bound) {
+			const string& cur=*sides[s];
+			size_t shared=0;
+			if(bound%interval==0) {
+				if(arena.size()>UINT32_MAX)	// restart offsets are 32 bits
+					throw runtime_error("FrozenTextRange: boundaries exceed 4 GB");
+				restarts.push_back(arena.size());
+			} else {
+				size_t maxlen=min(prev->size(),cur.size());
+				while(shared<maxlen && (*prev)[shared]==cur[shared])
+					shared++;
+			}
+			PutVarint(arena,shared);
+			PutVarint(arena,cur.size()-shared);
+			arena.append(cur,shared,string::npos);
+			if(incl[s])
+				flags[bound/64]|=uint64_t(1)<<(bound%64);
+			prev=&cur;
+		}
+	}
+
+	Header h={kMagic,kVersion,nranges,interval,(uint32_t)restarts.size(),kByteOrder,arena.size()};
+	size_t foff=FlagsOffset(h.nrestarts);
+	string img(foff+flags.size()*sizeof(uint64_t),'\0');
+	memcpy(&img[0],&h,sizeof(h));
+	if(!restarts.empty())
+		memcpy(&img[sizeof(h)],restarts.data(),restarts.size()*sizeof(uint32_t));
+	if(!flags.empty())
+		memcpy(&img[foff],flags.data(),flags.size()*sizeof(uint64_t));
+	img+=arena;
+
+	auto buf=make_shared<const string>(std::move(img));
+	base=buf->data();
+	size=buf->size();
+	owner=buf;
+}
+
+inline size_t FrozenTextRange::FlagsOffset(uint32_t nrestarts) {
+	size_t off=sizeof(Header)+nrestarts*sizeof(uint32_t);
+	return (off+7)&~size_t(7);
+}
+
+inline const uint64_t* FrozenTextRange::Flags() const {
+	return reinterpret_cast<const uint64_t*>(base+FlagsOffset(Head().nrestarts));
+}
+
+inline const unsigned char* FrozenTextRange::Arena() const {
+	size_t nwords=(2*(size_t)Head().nranges+63)/64;
+	return reinterpret_cast<const unsigned char*>(base+FlagsOffset(Head().nrestarts)+nwords*sizeof(uint64_t));
+}
+
+inline void FrozenTextRange::PutVarint(string& out, uint64_t val) {
+	while(val>=0x80) {
+		out+=char((val&0x7f)|0x80);
+		val>>=7;
+	}
+	out+=char(val);
+}
+
+inline const unsigned char* FrozenTextRange::GetVarint(const unsigned char* p, uint64_t& val) {
+	val=0;
+	for(int shift=0;;shift+=7) {
+		unsigned char b=*p++;
+		val|=uint64_t(b&0x7f)<<shift;
+		if(!(b&0x80))
+			return p;
+	}
+}
+
+inline const unsigned char* FrozenTextRange::Decode(const unsigned char* p, string& prev) {
+	uint64_t shared, unshared;
+	p=GetVarint(p,shared);
+	p=GetVarint(p,unshared);
+	prev.resize(shared);
+	prev.append(reinterpret_cast<const char*>(p),unshared);
+	return p+unshared;
+}
+
+// Restart boundaries are stored in full, so they are compared in place
+inline string_view FrozenTextRange::RestartKey(const unsigned char* p) {
+	uint64_t shared, len;
+	p=GetVarint(p,shared);
+	p=GetVarint(p,len);
+	return string_view(reinterpret_cast<const char*>(p),len);
+}
+
+// Query:
+// 	Binary search the last restart(always a lower boundary) at or below the key,
+// 	then decode its block until the range which may contain the key.
+inline bool FrozenTextRange::InRange(string_view key) const {
+	const Header& h=Head();
+	const uint32_t* restarts=Restarts();
+	const unsigned char* arena=Arena();
+	if(h.nrestarts==0 || RestartKey(arena+restarts[0]).compare(key)>0)
+		return false;
+
+	uint32_t lo=0, hi=h.nrestarts;	// restarts[lo] <= key < restarts[hi]
+	while(hi-lo>1) {
+		uint32_t mid=lo+(hi-lo)/2;
+		if(RestartKey(arena+restarts[mid]).compare(key)<=0)
+			lo=mid;
+		else
+			hi=mid;
+	}
+
+	size_t bound=(size_t)lo*h.interval;
+	size_t end=min(bound+h.interval,2*(size_t)h.nranges);
+	const unsigned char* p=arena+restarts[lo];
+	string cur;
+	for(;bound<end;bound+=2) {
+		p=Decode(p,cur);	// lower boundary
+		int cmp=key.compare(cur);
+		if(cmp<0)
+			return false;
+		bool lower=cmp>0 || Inclusive(bound);
+		p=Decode(p,cur);	// upper boundary
+		cmp=key.compare(cur);
+		if(cmp<0 || (cmp==0 && Inclusive(bound+1)))
+			return lower;
+		if(cmp==0)
+			return false;
+	}
+
+	return false;
+}
+
+inline Range FrozenTextRange::GetRange(int idx) const {
+	const Header& h=Head();
+	if(idx<0 || (uint32_t)idx>=h.nranges)
+		throw out_of_range("FrozenTextRange: range index out of range");
+
+	size_t target=2*(size_t)idx;
+	size_t bound=target/h.interval*h.interval;
+	const unsigned char* p=Arena()+Restarts()[bound/h.interval];
+	string cur;
+	for(;bound<target;++bound)
+		p=Decode(p,cur);
+
+	Range rng;
+	rng.linc=Inclusive(target) ? '[' : '(';
+	rng.rinc=Inclusive(target+1) ? ']' : ')';
+	p=Decode(p,cur);
+	rng.lower=cur;
+	Decode(p,cur);
+	rng.upper=cur;
+	return rng;
+}
+
+inline TextRange FrozenTextRange::Thaw() const {
+	const Header& h=Head();
+	vector<Range> rngs(h.nranges);
+	const unsigned char* p=Arena();
+	string cur;
+	for(size_t i=0;i<h.nranges;++i) {
+		rngs[i].linc=Inclusive(2*i) ? '[' : '(';
+		rngs[i].rinc=Inclusive(2*i+1) ? ']' : ')';
+		p=Decode(p,cur);
+		rngs[i].lower=cur;
+		p=Decode(p,cur);
+		rngs[i].upper=cur;
+	}
+
+	return TextRange(rngs);
+}
+
+// Load a serialized image, validated as a mapped one
+inline FrozenTextRange FrozenTextRange::Deserialize(string data) {
+	FrozenTextRange frz;
+	auto buf=make_shared<const string>(std::move(data));
+	frz.base=buf->data();
+	frz.size=buf->size();
+	frz.owner=buf;
+	frz.Validate();
+	return frz;
+}
+
+// Write to a temporary file first, so that readers never map a partial image
+inline void FrozenTextRange::Save(const string& path) const {
+	string tmp=path+".tmp";
+	FILE* fp=fopen(tmp.c_str(),"wb");
+	if(!fp)
+		throw runtime_error("FrozenTextRange: cannot create "+tmp+": "+strerror(errno));
+	bool ok=fwrite(base,1,size,fp)==size;
+	ok=fclose(fp)==0 && ok;
+	if(!ok || rename(tmp.c_str(),path.c_str())!=0) {
+		string err=strerror(errno);
+		remove(tmp.c_str());
+		throw runtime_error("FrozenTextRange: cannot write "+path+": "+err);
+	}
+}
+
+inline FrozenTextRange FrozenTextRange::Open(const string& path) {
+	int fd=open(path.c_str(),O_RDONLY);
+	if(fd<0)
+		throw runtime_error("FrozenTextRange: cannot open "+path+": "+strerror(errno));
+	struct stat st;
+	if(fstat(fd,&st)!=0 || st.st_size<(off_t)sizeof(Header)) {
+		close(fd);
+		throw runtime_error("FrozenTextRange: truncated file "+path);
+	}
+	size_t len=st.st_size;
+	void* addr=mmap(nullptr,len,PROT_READ,MAP_SHARED,fd,0);
+	close(fd);	// the mapping stays valid
+	if(addr==MAP_FAILED)
+		throw runtime_error("FrozenTextRange: cannot map "+path+": "+strerror(errno));
+
+	FrozenTextRange frz;
+	frz.owner=shared_ptr<const void>(addr,[len](const void* p) {munmap(const_cast<void*>(p),len);});
+	frz.base=static_cast<const char*>(addr);
+	frz.size=len;
+	frz.Validate();
+	return frz;
+}
+
+// Check the header, the restarts and every boundary against the image, throwing
+// runtime_error if any is invalid, so that lookups never read past the arena
+inline void FrozenTextRange::Validate() const {
+	if(size<sizeof(Header))
+		throw runtime_error("FrozenTextRange: truncated header");
+	const Header& h=Head();
+	if(h.byte_order==__builtin_bswap32(kByteOrder))
+		throw runtime_error("FrozenTextRange: image written with a different byte order");
+	if(h.magic!=kMagic || h.byte_order!=kByteOrder)
+		throw runtime_error("FrozenTextRange: bad magic");
+	if(h.version!=kVersion)
+		throw runtime_error("FrozenTextRange: unsupported version");
+	if(h.interval<2 || h.interval%2)
+		throw runtime_error("FrozenTextRange: bad restart interval");
+	if(h.nrestarts!=(2*(uint64_t)h.nranges+h.interval-1)/h.interval)
+		throw runtime_error("FrozenTextRange: bad number of restarts");
+	uint64_t nwords=(2*(uint64_t)h.nranges+63)/64;
+	uint64_t arena_off=FlagsOffset(h.nrestarts)+nwords*sizeof(uint64_t);
+	if(arena_off+h.arena_size!=size || (h.nrestarts==0 && h.arena_size!=0))
+		throw runtime_error("FrozenTextRange: size mismatch");
+	const uint32_t* restarts=Restarts();
+	for(uint32_t i=0;i<h.nrestarts;++i) {
+		if(restarts[i]>=h.arena_size || (i ? restarts[i]<=restarts[i-1] : restarts[i]!=0))
+			throw runtime_error("FrozenTextRange: bad restart offset");
+	}
+
+	// Every block is decoded once: the varints and the bytes of every boundary
+	// must end within the block, sharing no more than the previous boundary and
+	// nothing at all at the restart, and the block must end at the next restart.
+	const unsigned char* arena=Arena();
+	auto varint=[](const unsigned char*& p, const unsigned char* end, uint64_t& val) {
+		val=0;
+		for(int shift=0;p<end && shift<64;shift+=7) {
+			unsigned char b=*p++;
+			val|=uint64_t(b&0x7f)<<shift;
+			if(!(b&0x80))
+				return true;
+		}
+		return false;
+	};
+	size_t nbounds=2*(size_t)h.nranges;
+	for(uint32_t i=0;i<h.nrestarts;++i) {
+		const unsigned char* p=arena+restarts[i];
+		const unsigned char* end=arena+(i+1<h.nrestarts ? restarts[i+1] : h.arena_size);
+		uint64_t prev=0;	// length of the previous boundary
+		for(size_t bound=(size_t)i*h.interval;bound<min(nbounds,((size_t)i+1)*h.interval);++bound) {
+			uint64_t shared, unshared;
+			if(!varint(p,end,shared) || !varint(p,end,unshared) || shared>prev
+					|| (bound%h.interval==0 && shared!=0) || unshared>(uint64_t)(end-p))
+				throw runtime_error("FrozenTextRange: bad boundary");
+			p+=unshared;
+			prev=shared+unshared;
+		}
+		if(p!=end)
+			throw runtime_error("FrozenTextRange: bad boundary");
+	}
+}
+
+#endif
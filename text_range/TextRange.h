@@ -1,146 +1,427 @@
+#ifndef _TEXT_RANGE_H_
+#define _TEXT_RANGE_H_
+
 #include <iostream>
+#include <sstream>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <cstddef>	// std::size_t
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <algorithm>
+#include <functional>
+#include <numeric>
+#include <set>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
 
 using namespace std;
 
+// Malformed range specification. The position is the offset in the input
+// where the error was found.
+class TextRangeParseError: public invalid_argument {
+public:
+	TextRangeParseError(const string& msg, size_t pos):
+		invalid_argument("invalid text range: "+msg+" at position "+to_string(pos)), pos(pos) {}
+	size_t Position() const {return pos;}
+private:
+	size_t pos;
+};
+
+// Keys of a range set. Strings are looked up through string_view, so that query
+// keys are never copied, other keys by value. KeyLess must order the views.
+template<typename Key, typename KeyLess>
+struct RangeKey {
+	typedef typename conditional<is_same<Key,string>::value,string_view,Key>::type View;
+
+	// Three-way comparison, a single pass over strings
+	static int Cmp(const View& x, const View& y) {
+		if constexpr (is_same<Key,string>::value && is_same<KeyLess,less<> >::value)
+			return x.compare(y);
+		else
+			return KeyLess()(x,y) ? -1 : (KeyLess()(y,x) ? 1 : 0);
+	}
+};
+
 // Data structure for a single range
-struct Range {
+template<typename Key, typename KeyLess=less<> >
+struct BasicRange {
 public:
 	char linc;	// left-side(lower-bound) inclusion, '(' or '['
 	char rinc;	// right-side(upper-bound) inclusion, ')' or ']'
-	string lower;	// lower boundaries
-	string upper;	// upper boundaries
+	Key lower;	// lower boundaries
+	Key upper;	// upper boundaries
 
-	Range(){}	// default constructor
-	Range(string str);	// constructor
-private:
-	void FormatError(string str);	// Print format error
+	BasicRange(){}	// default constructor
+	BasicRange(string_view str);	// Parse a range of strings, throws TextRangeParseError
+	BasicRange(char l, Key lo, Key up, char r):linc(l),rinc(r),lower(std::move(lo)),upper(std::move(up)){}
+
+	bool Empty() const;	// no key is inside the range
+
+	// Parse the range starting at str[pos] and ending before the next ',' or
+	// the end of str. Returns the position where it ends.
+	size_t Parse(string_view str, size_t pos);
+	static bool IsSpace(char c) {return c==' ' || (c>='\t' && c<='\r');}
 };
 
-// Data structure for a text range
-class TextRange {
+// Order ranges by lower boundaries. An inclusive lower boundary comes before an
+// exclusive one of the same value. Ranges can also be compared with a key, to
+// look up ranges by value without building a Range.
+template<typename Key, typename KeyLess=less<> >
+struct BasicRangeLess {
+	typedef void is_transparent;
+	typedef BasicRange<Key,KeyLess> Range;
+	typedef typename RangeKey<Key,KeyLess>::View View;
+
+	bool operator()(const Range& x, const Range& y) const {
+		int cmp=RangeKey<Key,KeyLess>::Cmp(x.lower,y.lower);
+		return cmp<0 || (cmp==0 && x.linc=='[' && y.linc=='(');
+	}
+	bool operator()(const Range& x, const View& y) const {return KeyLess()(x.lower,y);}
+	bool operator()(const View& x, const Range& y) const {return KeyLess()(x,y.lower);}
+};
+
+// Data structure for a set of ranges over any ordered keys
+//
+// Ranges of strings are kept in a balanced tree. Ranges of integral keys are
+// stored inline in a sorted array, which is searched without branches; updates
+// shift the array, which is still cheap for the sizes of numeric range tables.
+template<typename Key, typename KeyLess=less<> >
+class BasicTextRange {
 public:
-	TextRange();
-	~TextRange();
-	TextRange(string str); // Build ranges from string
-
-	TextRange operator+(const TextRange& rng); // Addition of a text Range to the set being tracked.
-	TextRange operator+(const Range& rng); // Addition of a text Range to the set being tracked.
-	TextRange& operator+=(const TextRange& rng);
-	TextRange& operator+=(const Range& rng);
-	TextRange operator-(const TextRange& rng); // Deletion of a text Range from the set being tracked.
-	TextRange operator-(const Range& rng);
-	TextRange& operator-=(const TextRange& rng);
-	TextRange& operator-=(const Range& rng);
-	bool InRange(const TextRange& rng) const; // Query on whether a range is inside the set of Ranges.
+	typedef BasicRange<Key,KeyLess> Range;
+	typedef BasicRangeLess<Key,KeyLess> RangeLess;
+	typedef typename RangeKey<Key,KeyLess>::View KeyView;
+	static constexpr bool kFlat=is_integral<Key>::value;
+	// disjoint ranges, ordered by lower boundaries
+	typedef typename conditional<kFlat,vector<Range>,set<Range,RangeLess> >::type RangeStore;
+
+	BasicTextRange();
+	BasicTextRange(string_view str); // Build ranges of strings from string, throws TextRangeParseError
+	BasicTextRange(vector<Range> rngs); // Build ranges from a list of ranges, in O(n*log(n))
+
+	// The compound operators update the ranges in place. The binary operators
+	// copy the left operand, or reuse it when it is a temporary.
+	BasicTextRange operator+(const BasicTextRange& rng) const&; // Addition of a text Range to the set being tracked.
+	BasicTextRange operator+(const BasicTextRange& rng) &&;
+	BasicTextRange operator+(const Range& rng) const&; // Addition of a text Range to the set being tracked.
+	BasicTextRange operator+(const Range& rng) &&;
+	BasicTextRange& operator+=(const BasicTextRange& rng);
+	BasicTextRange& operator+=(const Range& rng);
+	BasicTextRange operator-(const BasicTextRange& rng) const&; // Deletion of a text Range from the set being tracked.
+	BasicTextRange operator-(const BasicTextRange& rng) &&;
+	BasicTextRange operator-(const Range& rng) const&;
+	BasicTextRange operator-(const Range& rng) &&;
+	BasicTextRange& operator-=(const BasicTextRange& rng);
+	BasicTextRange& operator-=(const Range& rng);
+	BasicTextRange operator&(const BasicTextRange& rng) const; // Intersection of two sets of Ranges.
+	BasicTextRange& operator&=(const BasicTextRange& rng);
+	bool InRange(const BasicTextRange& rng) const; // Query on whether a range is inside the set of Ranges.
 	bool InRange(const Range& rng) const;
-	bool InRange(const string str) const; // Query on whether a string is inside the set of Ranges being tracked.
+	bool InRange(KeyView key) const; // Query on whether a key is inside the set of Ranges being tracked.
+	bool InRange(const string& key) const {return InRange(string_view(key));}
+	bool InRange(const char* key) const {return InRange(string_view(key));}
+	vector<bool> BatchInRange(const vector<KeyView>& keys) const; // Query many keys in one pass.
 	
 	int GetRangeNum() const {return range.size();}
-	const vector<Range>& GetRange() const {return range;}	// Get a range by index
+	const RangeStore& GetRange() const {return range;}	// Get the ranges ordered by lower boundaries
 	void Print() const;	// Print ranges
 	string ToString() const;	// convert to string
 
 protected:
-	void Sort();	// Sort ranges by the lower boundaries
+	void Build(vector<Range>& rngs);	// Sort ranges and merge them in one pass
+	void Assign(vector<Range>& rngs);	// Replace ranges by sorted disjoint ranges
+	bool PreferSweep(const BasicTextRange& rng) const;	// merge whole sets rather than range by range
+
+	// Linear merges of the sorted ranges of two sets
+	static vector<Range> Union(const RangeStore& x, const RangeStore& y);
+	static vector<Range> Difference(const RangeStore& x, const RangeStore& y);
+	static vector<Range> Intersection(const RangeStore& x, const RangeStore& y);
+	void Insert(const Range& rng);	// Add a range in O(log n + merged ranges)
+	void Remove(const Range& rng);	// Delete a range in O(log n + overlapped ranges)
+	// First range starting after a range or a key
+	template<typename K> typename RangeStore::const_iterator UpperBound(const K& key) const;
+
+	static bool LowerLess(const Range& x, const Range& y);	// x starts before y
+	static bool UpperLess(const Range& x, const Range& y);	// x ends before y
+	static bool Separated(const Range& x, const Range& y);	// x ends before y starts, and they can't be merged
+	static bool DisjointBefore(const Range& x, const Range& y);	// x ends before y starts, without common keys
+	static int Cmp(const KeyView& x, const KeyView& y) {return RangeKey<Key,KeyLess>::Cmp(x,y);}
+	static string KeyToString(const Key& key);
+
+	// Big-endian integer of the first 8 bytes of a string, so that most string
+	// comparisons are decided by a single integer comparison.
+	static constexpr bool kPrefixed=is_same<Key,string>::value && is_same<KeyLess,less<> >::value;
+	static uint64_t Prefix(const KeyView& key);
+	static int Compare(uint64_t xpre, const KeyView& x, uint64_t ypre, const KeyView& y);
 
 private:
-	vector<Range> range;	// ranges
-
-	string Min(string a, string b){return a>b ? b : a;}
-	string Max(string a, string b){return a>b ? a : b;}
-	static bool cmpFunction(Range& x, Range& y) {return x.lower < y.lower;}
+	RangeStore range;	// disjoint ranges, ordered by lower boundaries
 };
 
+// Ranges of strings
+typedef BasicRange<string> Range;
+typedef BasicRangeLess<string> RangeLess;
+typedef BasicTextRange<string> TextRange;
+typedef TextRange::RangeStore RangeSet;
+
 
 // Build a single range from string, like "[AaA - bb)"
-Range::Range(string str) {
-	// Parse string
-	string delimiter="-";
-	size_t pos=0;
-	if((pos = str.find(delimiter)) != std::string::npos) {
-		string left=str.substr(0,pos);
-		str.erase(0,pos+delimiter.length());
-		string right=str;
-
-		// left part
-		string whitespaces(" \t\f\v\n\r");
-		pos=left.find_first_of("([");
-		if(pos!=std::string::npos) {
-			linc=left[pos];
-			left.erase(0,pos+1);	// trim leading spaces
-			pos=left.find_last_not_of(whitespaces);
-			if(pos!=std::string::npos)
-				left.erase(pos+1);	// trim ending spaces
-			lower=left;
-		} else {
-			FormatError(str);
-		}
+template<typename Key, typename KeyLess>
+BasicRange<Key,KeyLess>::BasicRange(string_view str) {
+	size_t end=Parse(str,0);
+	if(end!=str.size())
+		throw TextRangeParseError("unexpected ','",end);
+}
 
-		// right part
-		pos=right.find_first_not_of(whitespaces);
-		if(pos!=std::string::npos) {
-			right.erase(0,pos);	// trim leading spaces
-			pos=right.find_last_of(")]");
-			if(pos!=std::string::npos)
-				rinc=right[pos];	
-			else {
-				FormatError(right);
-			}
-			right.erase(pos);	// trim ending spaces
-			upper=right;
-		} else {
-			FormatError(right);
-		}
-	} else {
-		// For string like "AbC", set a default upper boundary.
+// A range is either "[lower-upper)" with any inclusion on both sides, or a
+// single string like "AbC", which is the range [AbC-AbC]. Spaces around the
+// boundaries are ignored. The input is scanned once, only the boundaries are copied.
+template<typename Key, typename KeyLess>
+size_t BasicRange<Key,KeyLess>::Parse(string_view str, size_t pos) {
+	static_assert(is_same<Key,string>::value,"only ranges of strings are parsed");
+	size_t end=str.find(',',pos);
+	if(end==string_view::npos)
+		end=str.size();
+
+	size_t b=pos, e=end;	// trim spaces
+	while(b<e && IsSpace(str[b]))
+		b++;
+	while(e>b && IsSpace(str[e-1]))
+		e--;
+	if(b==e)
+		throw TextRangeParseError("empty range",b);
+
+	if(str[b]!='(' && str[b]!='[') {
+		if(str.substr(b,e-b).find('-')!=string_view::npos)
+			throw TextRangeParseError("expected '(' or '['",b);
 		linc='[';
 		rinc=']';
-		lower=str;
-		upper=str;
+		lower.assign(str.data()+b,e-b);
+		upper=lower;
+		return end;
 	}
-}
 
-inline void Range::FormatError(string str) {
-	string err_msg="ERROR: invalid text range type: ";
-	cerr<<err_msg<<str<<endl;
-	exit(1);
+	linc=str[b];
+	if(e-b<2 || (str[e-1]!=')' && str[e-1]!=']'))
+		throw TextRangeParseError("expected ')' or ']'",e-1);
+	rinc=str[e-1];
+	size_t dash=str.substr(b+1,e-b-2).find('-');
+	if(dash==string_view::npos)
+		throw TextRangeParseError("expected '-'",b+1);
+	dash+=b+1;
+
+	size_t lb=b+1, le=dash;
+	while(lb<le && IsSpace(str[lb]))
+		lb++;
+	while(le>lb && IsSpace(str[le-1]))
+		le--;
+	size_t ub=dash+1, ue=e-1;
+	while(ub<ue && IsSpace(str[ub]))
+		ub++;
+	while(ue>ub && IsSpace(str[ue-1]))
+		ue--;
+	lower.assign(str.data()+lb,le-lb);
+	upper.assign(str.data()+ub,ue-ub);
+	return end;
 }
 
 // Default constructor
-TextRange::TextRange() {
+template<typename Key, typename KeyLess>
+BasicTextRange<Key,KeyLess>::BasicTextRange() {
 	// empty range
 }
 
-// Default destructor
-TextRange::~TextRange() {
-
-}
-
 //
 // The input string may contain several ranges, and each range is separated by "-". 
 // An example of input string is:
 // 		"[AaA - bb),[Dd-df]"
 //
-TextRange::TextRange(string str) {
+template<typename Key, typename KeyLess>
+BasicTextRange<Key,KeyLess>::BasicTextRange(string_view str) {
+	static_assert(is_same<Key,string>::value,"only ranges of strings are parsed");
 	// Parse string and initialize TextRange
-	string delimiter=",";
+	vector<Range> rngs;
 	size_t pos=0;
-	while((pos = str.find(delimiter)) != std::string::npos) {
-		string r=str.substr(0,pos);
-		str.erase(0,pos+delimiter.length());
-		Range rng(r);
-		*this += rng;
+	while(pos<str.size() && Range::IsSpace(str[pos]))
+		pos++;
+	if(pos<str.size()) {
+		rngs.reserve(count(str.begin()+pos,str.end(),',')+1);
+		while(true) {
+			rngs.emplace_back();
+			pos=rngs.back().Parse(str,pos);
+			if(pos==str.size())
+				break;
+			pos++;	// skip ','
+		}
+	}
+	Build(rngs);
+}
+
+// Build from a list of ranges, which may overlap and be in any order
+template<typename Key, typename KeyLess>
+BasicTextRange<Key,KeyLess>::BasicTextRange(vector<Range> rngs) {
+	Build(rngs);
+}
+
+// Sort the ranges by lower boundaries, then merge every range into the previous
+// one if they overlap or touch. The merged ranges come out in order, so each of
+// them is appended to the set in amortized constant time.
+template<typename Key, typename KeyLess>
+void BasicTextRange<Key,KeyLess>::Build(vector<Range>& rngs) {
+	range.clear();
+	if(!is_sorted(rngs.begin(),rngs.end(),RangeLess()))	// specs are often written in order
+		sort(rngs.begin(),rngs.end(),RangeLess());
+
+	typename vector<Range>::iterator cur=rngs.end();
+	for(typename vector<Range>::iterator it=rngs.begin();it!=rngs.end();++it) {
+		if(it->Empty())
+			continue;
+		if(cur==rngs.end()) {
+			cur=it;
+		} else if(Separated(*cur,*it)) {
+			range.insert(range.end(),std::move(*cur));
+			cur=it;
+		} else if(UpperLess(*cur,*it)) {
+			cur->upper=std::move(it->upper);
+			cur->rinc=it->rinc;
+		}
 	}
-	if(!str.empty()) {
-		Range rng(str);
-		*this += rng;
+	if(cur!=rngs.end())
+		range.insert(range.end(),std::move(*cur));
+}
+
+// The ranges are already sorted and disjoint, append them in order
+template<typename Key, typename KeyLess>
+void BasicTextRange<Key,KeyLess>::Assign(vector<Range>& rngs) {
+	range.clear();
+	for(Range& r:rngs)
+		range.insert(range.end(),std::move(r));
+}
+
+// Applying m ranges one by one costs O(m*log(n)), a sweep over both sets O(n+m)
+template<typename Key, typename KeyLess>
+bool BasicTextRange<Key,KeyLess>::PreferSweep(const BasicTextRange& rng) const {
+	size_t n=range.size(), m=rng.range.size(), logn=1;
+	while((n>>logn)>0)
+		logn++;
+	return m*logn > n+m;
+}
+
+// Union of two sets of disjoint ranges: walk both sets in the order of lower
+// boundaries, and merge every range into the previous one if they touch.
+template<typename Key, typename KeyLess>
+vector<BasicRange<Key,KeyLess> > BasicTextRange<Key,KeyLess>::Union(const RangeStore& x, const RangeStore& y) {
+	vector<Range> out;
+	typename RangeStore::const_iterator i=x.begin(), j=y.begin();
+	while(i!=x.end() || j!=y.end()) {
+		const Range& next=(j==y.end() || (i!=x.end() && !LowerLess(*j,*i))) ? *i++ : *j++;
+		if(out.empty() || Separated(out.back(),next)) {
+			out.push_back(next);
+		} else if(UpperLess(out.back(),next)) {
+			out.back().upper=next.upper;
+			out.back().rinc=next.rinc;
+		}
 	}
-	//this->Sort();
+
+	return out;
+}
+
+// Difference of two sets of disjoint ranges. For every range of x, the ranges of
+// y ending before it are skipped for good, and the ones overlapping it cut it
+// into pieces. Each range of y is skipped once and overlaps at most one range of
+// x without ending inside it, so the merge is linear.
+template<typename Key, typename KeyLess>
+vector<BasicRange<Key,KeyLess> > BasicTextRange<Key,KeyLess>::Difference(const RangeStore& x, const RangeStore& y) {
+	vector<Range> out;
+	typename RangeStore::const_iterator j=y.begin();
+	for(typename RangeStore::const_iterator i=x.begin();i!=x.end();++i) {
+		while(j!=y.end() && DisjointBefore(*j,*i))
+			++j;
+
+		Range cur=*i;
+		bool left=true;	// something of cur is left above the ranges cut so far
+		for(typename RangeStore::const_iterator k=j;k!=y.end() && !DisjointBefore(cur,*k);++k) {
+			Range below(cur.linc, cur.lower, k->lower, k->linc=='(' ? ']' : ')');
+			if(!below.Empty())
+				out.push_back(below);
+			Range above(k->rinc==']' ? '(' : '[', k->upper, cur.upper, cur.rinc);
+			if(above.Empty()) {
+				left=false;
+				break;
+			}
+			cur=above;
+		}
+		if(left)
+			out.push_back(cur);
+	}
+
+	return out;
+}
+
+// Intersection of two sets of disjoint ranges: intersect the current ranges of
+// both sets, then move on from the one which ends first.
+template<typename Key, typename KeyLess>
+vector<BasicRange<Key,KeyLess> > BasicTextRange<Key,KeyLess>::Intersection(const RangeStore& x, const RangeStore& y) {
+	vector<Range> out;
+	typename RangeStore::const_iterator i=x.begin(), j=y.begin();
+	while(i!=x.end() && j!=y.end()) {
+		if(DisjointBefore(*i,*j)) {
+			++i;
+		} else if(DisjointBefore(*j,*i)) {
+			++j;
+		} else {
+			const Range& lo=LowerLess(*i,*j) ? *j : *i;
+			const Range& hi=UpperLess(*i,*j) ? *i : *j;
+			out.push_back(Range(lo.linc, lo.lower, hi.upper, hi.rinc));
+			if(UpperLess(*i,*j))
+				++i;
+			else
+				++j;
+		}
+	}
+
+	return out;
+}
+
+// A range is empty if its lower boundary is above the upper one, or they are
+// equal but at least one side is exclusive, like "(a-a]".
+template<typename Key, typename KeyLess>
+bool BasicRange<Key,KeyLess>::Empty() const {
+	int cmp=RangeKey<Key,KeyLess>::Cmp(upper,lower);
+	return cmp<0 || (cmp==0 && !(linc=='[' && rinc==']'));
+}
+
+// Comparisons of boundaries. Strings are compared using string comparison rules,
+// and for equal strings the inclusion characters decide:
+// 	"[a" starts before "(a", and "a)" ends before "a]".
+template<typename Key, typename KeyLess>
+bool BasicTextRange<Key,KeyLess>::LowerLess(const Range& x, const Range& y) {
+	int cmp=Cmp(x.lower,y.lower);
+	return cmp<0 || (cmp==0 && x.linc=='[' && y.linc=='(');
+}
+
+template<typename Key, typename KeyLess>
+bool BasicTextRange<Key,KeyLess>::UpperLess(const Range& x, const Range& y) {
+	int cmp=Cmp(x.upper,y.upper);
+	return cmp<0 || (cmp==0 && x.rinc==')' && y.rinc==']');
+}
+
+// [a-b) and (b-c] leave b uncovered, so they stay separated. [a-b) + [b-c] = [a-c].
+template<typename Key, typename KeyLess>
+bool BasicTextRange<Key,KeyLess>::Separated(const Range& x, const Range& y) {
+	int cmp=Cmp(x.upper,y.lower);
+	return cmp<0 || (cmp==0 && x.rinc==')' && y.linc=='(');
+}
+
+// [a-b) and [b-c] have no common string, [a-b] and [b-c] have b in common.
+template<typename Key, typename KeyLess>
+bool BasicTextRange<Key,KeyLess>::DisjointBefore(const Range& x, const Range& y) {
+	int cmp=Cmp(x.upper,y.lower);
+	return cmp<0 || (cmp==0 && (x.rinc==')' || y.linc=='('));
 }
 
 // Addition:
@@ -157,51 +438,80 @@ TextRange::TextRange(string str) {
 // boundary with the upper boundary and vice versa.
 //
 // ASSUME that the lower and upper boundaries can be campared using string comparison rules.
-TextRange TextRange::operator+(const TextRange& rng) {
-	TextRange tmp=*this;
-	const vector<Range>& newRng=rng.GetRange();
-	for(int i=0;i<rng.GetRangeNum();++i) {
-		tmp += newRng[i];
-	}
-
+template<typename Key, typename KeyLess>
+BasicTextRange<Key,KeyLess> BasicTextRange<Key,KeyLess>::operator+(const BasicTextRange& rng) const& {
+	BasicTextRange tmp=*this;
+	tmp+=rng;
 	return tmp;
 }
 
-// Add a single range
-TextRange TextRange::operator+(const Range& rng) {
-	TextRange tmp=*this;
-	Range newRng=rng;
-	vector<Range>::iterator it=tmp.range.begin();
-	while(it!=tmp.range.end()) {
-		if(newRng.upper < it->lower) {
-			tmp.range.insert(it, newRng);
-			return *this;
-		} else if(newRng.lower > it->upper) {
-			it++;
-			continue;
-		} else {
-			newRng.lower=Min(newRng.lower,it->lower);
-			newRng.upper=Max(newRng.upper,it->upper);
-			it=tmp.range.erase(it);
-		}
-	}
-	tmp.range.push_back(newRng);
+template<typename Key, typename KeyLess>
+BasicTextRange<Key,KeyLess> BasicTextRange<Key,KeyLess>::operator+(const BasicTextRange& rng) && {
+	*this+=rng;
+	return std::move(*this);
+}
 
+// Add a single range
+template<typename Key, typename KeyLess>
+BasicTextRange<Key,KeyLess> BasicTextRange<Key,KeyLess>::operator+(const Range& rng) const& {
+	BasicTextRange tmp=*this;
+	tmp+=rng;
 	return tmp;
 }
 
+template<typename Key, typename KeyLess>
+BasicTextRange<Key,KeyLess> BasicTextRange<Key,KeyLess>::operator+(const Range& rng) && {
+	*this+=rng;
+	return std::move(*this);
+}
+
 // Compound assignment
-TextRange& TextRange::operator+=(const TextRange& rng) {
-	*this = *this + rng;
+template<typename Key, typename KeyLess>
+BasicTextRange<Key,KeyLess>& BasicTextRange<Key,KeyLess>::operator+=(const BasicTextRange& rng) {
+	if(&rng==this)	// the loop below would insert into the set it walks
+		return *this;
+	if(PreferSweep(rng)) {
+		vector<Range> merged=Union(range,rng.range);
+		Assign(merged);
+	} else {
+		for(const Range& r:rng.GetRange())
+			Insert(r);
+	}
 	return *this;
 }
 
 // Compound assignment
-TextRange& TextRange::operator+=(const Range& rng) {
-	*this = *this + rng;
+template<typename Key, typename KeyLess>
+BasicTextRange<Key,KeyLess>& BasicTextRange<Key,KeyLess>::operator+=(const Range& rng) {
+	Insert(rng);
 	return *this;
 }
 
+// Insert a range: only the ranges touching the new one are visited, they are
+// merged into it and replaced by the merged range.
+template<typename Key, typename KeyLess>
+void BasicTextRange<Key,KeyLess>::Insert(const Range& rng) {
+	if(rng.Empty())
+		return;
+
+	Range newRng=rng;
+	typename RangeStore::const_iterator it=UpperBound(newRng);	// first range starting after newRng
+	while(it!=range.begin() && !Separated(*prev(it),newRng))
+		--it;
+	typename RangeStore::const_iterator first=it;
+	for(;it!=range.end() && !Separated(newRng,*it);++it) {
+		if(LowerLess(*it,newRng)) {
+			newRng.lower=it->lower;
+			newRng.linc=it->linc;
+		}
+		if(UpperLess(newRng,*it)) {
+			newRng.upper=it->upper;
+			newRng.rinc=it->rinc;
+		}
+	}
+	range.insert(range.erase(first,it),std::move(newRng));
+}
+
 // Substraction:
 // 	1. If the two single ranges have intersections, then substract the common parts.
 // 	E.g.,
@@ -212,73 +522,121 @@ TextRange& TextRange::operator+=(const Range& rng) {
 // 	boundaries and merge/add them.
 //
 // ASSUME that the lower and upper boundaries can be campared using string comparison rules.
-TextRange TextRange::operator-(const TextRange& rng) {
-	TextRange tmp=*this;
-	const vector<Range>& newRng=rng.GetRange();
-	for(int i=0;i<rng.GetRangeNum();++i) {
-		tmp -= newRng[i];
-	}
-
+template<typename Key, typename KeyLess>
+BasicTextRange<Key,KeyLess> BasicTextRange<Key,KeyLess>::operator-(const BasicTextRange& rng) const& {
+	BasicTextRange tmp=*this;
+	tmp-=rng;
 	return tmp;
 }
 
-// Substraction
-TextRange TextRange::operator-(const Range& newRng) {
-	TextRange tmp=*this;
-	vector<Range>::iterator it=tmp.range.begin();
-	while(it!=tmp.range.end()) {
-		if(newRng.upper>it->lower && newRng.upper<it->upper) {
-			it->lower=newRng.upper;
-		} else if(newRng.lower>it->lower && newRng.lower<it->upper) {
-			it->upper=newRng.lower;
-		} else if(newRng.lower<it->lower && newRng.upper>it->upper) {
-			it=tmp.range.erase(it);
-		} else if(newRng.lower>it->lower && newRng.upper<it->upper){
-			// Separate this range into two parts
-			// Part 1
-			Range tmpRng;
-			tmpRng.linc=it->linc;
-			tmpRng.lower=it->lower;
-			tmpRng.upper=newRng.lower;
-			if(newRng.linc=='(')
-				tmpRng.rinc=']';
-			else
-				tmpRng.rinc=')';
-			tmp.range.insert(it,tmpRng);
-			tmp.Print(); // TEST ONLY
-
-			// Part 2
-			it++;
-			if(newRng.rinc==')')
-				tmpRng.linc='[';
-			else
-				tmpRng.linc='(';
-			tmpRng.lower=newRng.upper;
-			tmpRng.upper=it->upper;
-			tmpRng.rinc=it->rinc;
-			tmp.range.insert(it,tmpRng);
-			tmp.Print(); // TEST ONLY
-
-			// Delete the original range
-			it++;
-			it=tmp.range.erase(it);
-		} else {
-			it++;
-		}
-	}
+template<typename Key, typename KeyLess>
+BasicTextRange<Key,KeyLess> BasicTextRange<Key,KeyLess>::operator-(const BasicTextRange& rng) && {
+	*this-=rng;
+	return std::move(*this);
+}
 
+// Substraction
+template<typename Key, typename KeyLess>
+BasicTextRange<Key,KeyLess> BasicTextRange<Key,KeyLess>::operator-(const Range& rng) const& {
+	BasicTextRange tmp=*this;
+	tmp-=rng;
 	return tmp;
 }
 
+template<typename Key, typename KeyLess>
+BasicTextRange<Key,KeyLess> BasicTextRange<Key,KeyLess>::operator-(const Range& rng) && {
+	*this-=rng;
+	return std::move(*this);
+}
+
 // Compound assignment
-TextRange& TextRange::operator-=(const TextRange& rng) {
-	*this = *this - rng;
+template<typename Key, typename KeyLess>
+BasicTextRange<Key,KeyLess>& BasicTextRange<Key,KeyLess>::operator-=(const BasicTextRange& rng) {
+	if(&rng==this) {	// the loop below would erase from the set it walks
+		range.clear();
+		return *this;
+	}
+	if(PreferSweep(rng)) {
+		vector<Range> diff=Difference(range,rng.range);
+		Assign(diff);
+	} else {
+		for(const Range& r:rng.GetRange())
+			Remove(r);
+	}
 	return *this;
 }
 
 // Compound assignment
-TextRange& TextRange::operator-=(const Range& rng) {
-	*this = *this - rng;
+template<typename Key, typename KeyLess>
+BasicTextRange<Key,KeyLess>& BasicTextRange<Key,KeyLess>::operator-=(const Range& rng) {
+	Remove(rng);
+	return *this;
+}
+
+// Delete a range: the overlapped ranges are erased, only the part of the first
+// one below the deleted range and the part of the last one above it are left.
+template<typename Key, typename KeyLess>
+void BasicTextRange<Key,KeyLess>::Remove(const Range& rng) {
+	if(rng.Empty())
+		return;
+
+	typename RangeStore::const_iterator it=UpperBound(rng);	// first range starting after rng
+	while(it!=range.begin() && !DisjointBefore(*prev(it),rng))
+		--it;
+	typename RangeStore::const_iterator first=it;
+	while(it!=range.end() && !DisjointBefore(rng,*it))
+		++it;
+	if(first==it)
+		return;
+
+	Range below(first->linc, first->lower, rng.lower, rng.linc=='(' ? ']' : ')');
+	Range above(rng.rinc==']' ? '(' : '[', rng.upper, prev(it)->upper, prev(it)->rinc);
+	it=range.erase(first,it);
+	if(!above.Empty())
+		it=range.insert(it,std::move(above));
+	if(!below.Empty())
+		range.insert(it,std::move(below));
+}
+
+// Ranges of strings are looked up in the tree. Ranges of integral keys are
+// binary searched in the array with conditional moves only: the candidates
+// are halved without any branch on the comparisons.
+template<typename Key, typename KeyLess>
+template<typename K>
+typename BasicTextRange<Key,KeyLess>::RangeStore::const_iterator BasicTextRange<Key,KeyLess>::UpperBound(const K& key) const {
+	if constexpr (kFlat) {
+		RangeLess less;
+		const Range* base=range.data();
+		size_t n=range.size();
+		if(n==0)
+			return range.end();
+		while(n>1) {
+			size_t half=n/2;
+			base=less(key,base[half]) ? base : base+half;
+			n-=half;
+		}
+		return range.begin()+(base-range.data())+!less(key,*base);
+	} else {
+		return range.upper_bound(key);
+	}
+}
+
+// Intersection:
+// 	Keep the parts of the ranges which are covered by both sets. E.g.,
+// 		[AaA-CaC],[Dd-Df] & (BaB-Dda) = (BaB-CaC],[Dd-Dda)
+template<typename Key, typename KeyLess>
+BasicTextRange<Key,KeyLess> BasicTextRange<Key,KeyLess>::operator&(const BasicTextRange& rng) const {
+	BasicTextRange tmp;
+	vector<Range> common=Intersection(range,rng.range);
+	tmp.Assign(common);
+	return tmp;
+}
+
+// Compound assignment
+template<typename Key, typename KeyLess>
+BasicTextRange<Key,KeyLess>& BasicTextRange<Key,KeyLess>::operator&=(const BasicTextRange& rng) {
+	vector<Range> common=Intersection(range,rng.range);
+	Assign(common);
 	return *this;
 }
 
@@ -288,67 +646,153 @@ TextRange& TextRange::operator-=(const Range& rng) {
 // 	Otherwise, return false.
 //	2. Given multiple ranges, only if every single range is in this range, return true.
 //	Otherwise, return false.
-bool TextRange::InRange(const TextRange& rng) const {
-	bool ret=true;
-	const vector<Range>& newRng=rng.GetRange();
-	for(int i=0;i<rng.GetRangeNum();++i) {
-		if(!InRange(newRng[i])) {
-			ret=false;
-			break;
-		}
+template<typename Key, typename KeyLess>
+bool BasicTextRange<Key,KeyLess>::InRange(const BasicTextRange& rng) const {
+	for(const Range& r:rng.GetRange()) {
+		if(!InRange(r))
+			return false;
 	}
 
-	return ret;
+	return true;
 }
 
 // Query:
 // 	Given a single range, if both the lower boundary and the upper boundary are located
 // 	in this range, and the whole given range is covered in this range, then return true. 
 // 	Otherwise, return false.
-bool TextRange::InRange(const Range& rng) const {
-	bool ret=false;
-	for(int j=0;j<GetRangeNum();++j) {
-		if(rng.lower>=range[j].lower && rng.upper<=range[j].upper) {
-			if(!( (rng.lower==range[j].lower && range[j].linc!=rng.linc) || 
-						(rng.upper==range[j].upper && range[j].rinc!=rng.rinc) )) {
-				ret=true;
-				break;
-			}
-		}
-	} // end for
-
-	return ret;
+//
+// Since the ranges are disjoint, only the last range starting at or before the
+// given range can cover it.
+template<typename Key, typename KeyLess>
+bool BasicTextRange<Key,KeyLess>::InRange(const Range& rng) const {
+	typename RangeStore::const_iterator it=UpperBound(rng);
+	if(it==range.begin())
+		return false;
+	--it;
+
+	return !LowerLess(rng,*it) && !UpperLess(*it,rng);
 }
 
 // Query
-bool TextRange::InRange(const string str) const {
-	Range rng(str);
-	return InRange(rng);
+//
+// The key is looked up as is, without being parsed as a range specification nor
+// copied. Only the last range starting at or before the key can contain it.
+template<typename Key, typename KeyLess>
+bool BasicTextRange<Key,KeyLess>::InRange(KeyView key) const {
+	typename RangeStore::const_iterator it=UpperBound(key);	// first range starting above key
+	if(it==range.begin())
+		return false;
+	--it;
+
+	bool lower=it->linc=='[' || Cmp(it->lower,key)<0;
+	int cmp=Cmp(key,it->upper);
+	return lower && (cmp<0 || (cmp==0 && it->rinc==']'));
 }
 
-// Print text range
-inline void TextRange::Print() const {
-	for(int i=0;i<GetRangeNum();++i) {
-		cout<<range[i].linc<<range[i].lower<<"-"<<range[i].upper<<range[i].rinc;
-		if(i<GetRangeNum()-1)
-			cout<<",";
+// Only strings in byte order have prefixes, other keys get 0 and are compared in full.
+template<typename Key, typename KeyLess>
+uint64_t BasicTextRange<Key,KeyLess>::Prefix(const KeyView& key) {
+	uint64_t pre=0;
+	if constexpr (kPrefixed) {
+		memcpy(&pre,key.data(),min(key.size(),sizeof(pre)));	// zero padded
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__==__ORDER_LITTLE_ENDIAN__
+		pre=__builtin_bswap64(pre);
+#endif
 	}
-	cout<<endl;
+	return pre;
+}
+
+// Strings are compared as unsigned chars, which the prefixes agree with. Equal
+// prefixes fall back to a full comparison.
+template<typename Key, typename KeyLess>
+int BasicTextRange<Key,KeyLess>::Compare(uint64_t xpre, const KeyView& x, uint64_t ypre, const KeyView& y) {
+	if(xpre!=ypre)
+		return xpre<ypre ? -1 : 1;
+	return Cmp(x,y);
+}
+
+// Batch query:
+// 	Sort the keys(unless they are sorted already), then resolve all of them in one
+// 	merge walk over the ranges, which are sorted as well. Keys and range boundaries
+// 	are compared by their 8-bytes prefixes first(strings only). When there are only a few keys
+// 	compared to the ranges, every key is looked up independently instead.
+template<typename Key, typename KeyLess>
+vector<bool> BasicTextRange<Key,KeyLess>::BatchInRange(const vector<KeyView>& keys) const {
+	vector<bool> ret(keys.size(),false);
+	size_t n=range.size(), logn=1;
+	if(keys.empty() || n==0)
+		return ret;
+	while((n>>logn)>0)
+		logn++;
+	if(keys.size()*logn<n) {
+		for(size_t i=0;i<keys.size();++i)
+			ret[i]=InRange(keys[i]);
+		return ret;
+	}
+
+	vector<uint64_t> pre(keys.size());
+	for(size_t i=0;i<keys.size();++i)
+		pre[i]=Prefix(keys[i]);
+	vector<size_t> order(keys.size());
+	iota(order.begin(),order.end(),0);
+	bool sorted=true;
+	for(size_t i=1;i<keys.size() && sorted;++i)
+		sorted=Compare(pre[i-1],keys[i-1],pre[i],keys[i])<=0;
+	if(!sorted) {
+		sort(order.begin(),order.end(),[&](size_t x, size_t y) {
+			return Compare(pre[x],keys[x],pre[y],keys[y])<0;
+		});
+	}
+
+	typename RangeStore::const_iterator it=range.begin();
+	uint64_t lpre=Prefix(it->lower), upre=Prefix(it->upper);
+	for(size_t idx:order) {
+		const KeyView& key=keys[idx];
+		// skip the ranges ending before key
+		int cmp;
+		while((cmp=Compare(pre[idx],key,upre,it->upper))>0 || (cmp==0 && it->rinc==')')) {
+			if(++it==range.end())
+				return ret;
+			lpre=Prefix(it->lower);
+			upre=Prefix(it->upper);
+		}
+		cmp=Compare(lpre,it->lower,pre[idx],key);
+		ret[idx]=cmp<0 || (cmp==0 && it->linc=='[');
+	}
+
+	return ret;
+}
+
+// Print text range
+template<typename Key, typename KeyLess>
+void BasicTextRange<Key,KeyLess>::Print() const {
+	cout<<ToString()<<endl;
 }
 
 // Convert range to string
-inline string TextRange::ToString() const {
+template<typename Key, typename KeyLess>
+string BasicTextRange<Key,KeyLess>::ToString() const {
 	string str="";
-	for(int i=0;i<GetRangeNum();++i) {
-		str=str+range[i].linc+range[i].lower+"-"+range[i].upper+range[i].rinc;
-		if(i<GetRangeNum()-1)
+	for(typename RangeStore::const_iterator it=range.begin();it!=range.end();++it) {
+		if(it!=range.begin())
 			str+=",";
+		str=str+it->linc+KeyToString(it->lower)+"-"+KeyToString(it->upper)+it->rinc;
 	}
 
 	return str;
 }
 
-// Sort ranges according to the lower boundaries
-void TextRange::Sort() {
-	std::sort(range.begin(),range.end(),cmpFunction);
+template<typename Key, typename KeyLess>
+string BasicTextRange<Key,KeyLess>::KeyToString(const Key& key) {
+	if constexpr (is_same<Key,string>::value) {
+		return key;
+	} else if constexpr (is_integral<Key>::value) {
+		return to_string(key);
+	} else {
+		ostringstream os;
+		os<<key;
+		return os.str();
+	}
 }
+
+#endif
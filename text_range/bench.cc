@@ -0,0 +1,247 @@
+// Benchmark of TextRange at scale.
+//
+// For every generator, key length and set size(1k, 10k, ... up to -n ranges), a
+// set of ranges and a second set of the same size are generated, then the time
+// of construction, union, difference, single and batch lookups is measured with
+// the memory footprint. Results are printed as one JSON object per line, so
+// that runs of different versions can be compared by scripts.
+//
+// Build and run, up to 10M ranges(several GB of memory):
+// 		g++ -std=c++17 -O2 -o text_range_bench bench.cc
+// 		./text_range_bench -n 10000000 > results.jsonl
+#include <chrono>
+#include <random>
+#include <cstdio>
+#include <unistd.h>
+#include <malloc.h>
+#include "TextRange.h"
+#include "FrozenTextRange.h"
+
+static const int kFormatVersion=1;	// bump when fields change meaning
+
+typedef chrono::steady_clock BenchClock;
+
+static double ElapsedNs(BenchClock::time_point start) {
+	return chrono::duration<double,nano>(BenchClock::now()-start).count();
+}
+
+// Bytes allocated from the heap. Freed memory is reused between runs, so the
+// resident set size would not grow; fall back to it without glibc.
+static long HeapBytes() {
+#if defined(__GLIBC__) && (__GLIBC__>2 || (__GLIBC__==2 && __GLIBC_MINOR__>=33))
+	struct mallinfo2 mi=mallinfo2();
+	return mi.uordblks+mi.hblkhd;
+#else
+	long pages=0, resident=0;
+	FILE* fp=fopen("/proc/self/statm","r");
+	if(!fp)
+		return 0;
+	if(fscanf(fp,"%ld %ld",&pages,&resident)!=2)
+		resident=0;
+	fclose(fp);
+	return resident*sysconf(_SC_PAGESIZE);
+#endif
+}
+
+// Generates keys of a fixed length and ranges between them
+class Generator {
+public:
+	Generator(const string& name, size_t keylen, unsigned seed): name(name), keylen(keylen), rng(seed) {}
+
+	// n ranges in random order
+	vector<Range> Ranges(size_t n, size_t shift);	// shift moves ordered ranges between sets
+	// Keys for lookups, about half of them inside the ranges
+	vector<string> Keys(const vector<Range>& rngs, size_t n);
+
+private:
+	string RandomKey();
+	string NumberedKey(size_t i);	// keys in order of i
+
+	string name;
+	size_t keylen;
+	mt19937_64 rng;
+};
+
+// A key of random letters
+string Generator::RandomKey() {
+	string key(keylen,'a');
+	for(char& c:key)
+		c='a'+rng()%26;
+	return key;
+}
+
+// Zero padded decimal number. With the "prefix" generator all keys share a
+// prefix longer than 8 bytes, which defeats the prefix comparisons.
+string Generator::NumberedKey(size_t i) {
+	string num=to_string(i);
+	size_t width=max(keylen,num.size());
+	string key(width-num.size(),'0');
+	key+=num;
+	if(name=="prefix")
+		key="common/prefix/of/every/key/"+key;
+	return key;
+}
+
+// Generators:
+// 		random		narrow ranges at random places, some of them overlap
+// 		disjoint	ordered, non-overlapping ranges with gaps, shuffled
+// 		prefix		like disjoint, all keys sharing a long prefix
+// 		nested		ranges nested in each other, everything merges into one range
+vector<Range> Generator::Ranges(size_t n, size_t shift) {
+	vector<Range> rngs;
+	rngs.reserve(n);
+	for(size_t i=0;i<n;++i) {
+		if(name=="random") {
+			string lo=RandomKey(), up=lo;
+			up[keylen-1]='z';	// a few keys of random prefixes
+			if(keylen>1)
+				up[keylen-2]+=rng()%('z'-up[keylen-2]+1);
+			rngs.push_back(Range(rng()%2 ? '[' : '(',lo,up,rng()%2 ? ']' : ')'));
+		} else if(name=="nested") {
+			rngs.push_back(Range('[',NumberedKey(n-i),NumberedKey(n+i+shift),']'));
+		} else {
+			rngs.push_back(Range('[',NumberedKey(4*i+shift),NumberedKey(4*i+shift+2),')'));
+		}
+	}
+	shuffle(rngs.begin(),rngs.end(),rng);
+	return rngs;
+}
+
+vector<string> Generator::Keys(const vector<Range>& rngs, size_t n) {
+	vector<string> keys;
+	keys.reserve(n);
+	for(size_t i=0;i<n;++i) {
+		const Range& r=rngs[rng()%rngs.size()];
+		keys.push_back(rng()%2 ? r.lower : r.upper+"~");
+	}
+	return keys;
+}
+
+struct Options {
+	size_t min_ranges=1000;
+	size_t max_ranges=1000000;
+	size_t queries=100000;
+	string generator;	// all if empty
+	vector<size_t> keylens={8,32};
+};
+
+static void Run(const Options& opt, const string& gen_name, size_t keylen, size_t n) {
+	Generator gen(gen_name,keylen,n*31+keylen);
+	vector<Range> xr=gen.Ranges(n,0), yr=gen.Ranges(n,1);
+	vector<string> keys=gen.Keys(xr,opt.queries);
+	vector<string_view> kv(keys.begin(),keys.end());
+	vector<string_view> sorted_kv=kv;
+	sort(sorted_kv.begin(),sorted_kv.end());
+
+	long heap0=HeapBytes();
+	auto start=BenchClock::now();
+	TextRange x(xr);
+	double build_ns=ElapsedNs(start);
+	long heap1=HeapBytes();
+	TextRange y(yr);
+
+	string spec=x.ToString();
+	start=BenchClock::now();
+	TextRange parsed(spec);
+	double parse_ns=ElapsedNs(start);
+
+	start=BenchClock::now();
+	TextRange u=x+y;
+	double union_ns=ElapsedNs(start);
+	start=BenchClock::now();
+	TextRange d=x-y;
+	double diff_ns=ElapsedNs(start);
+
+	size_t found=0;
+	start=BenchClock::now();
+	for(string_view k:kv)
+		found+=x.InRange(k);
+	double lookup_ns=ElapsedNs(start)/kv.size();
+	start=BenchClock::now();
+	vector<bool> batch=x.BatchInRange(kv);
+	double batch_ns=ElapsedNs(start)/kv.size();
+	start=BenchClock::now();
+	batch=x.BatchInRange(sorted_kv);
+	double batch_sorted_ns=ElapsedNs(start)/kv.size();
+
+	start=BenchClock::now();
+	FrozenTextRange frz(x);
+	double freeze_ns=ElapsedNs(start);
+	size_t frozen_found=0;
+	start=BenchClock::now();
+	for(string_view k:kv)
+		frozen_found+=frz.InRange(k);
+	double frozen_lookup_ns=ElapsedNs(start)/kv.size();
+	if(frozen_found!=found) {
+		cerr<<"frozen lookups disagree: "<<frozen_found<<" vs "<<found<<endl;
+		exit(1);
+	}
+
+	printf("{\"bench\":\"text_range\",\"format\":%d,\"generator\":\"%s\",\"key_len\":%zu,\"ranges\":%zu,"
+		"\"merged_ranges\":%d,\"union_ranges\":%d,\"diff_ranges\":%d,\"queries\":%zu,\"hits\":%zu,"
+		"\"build_ns\":%.0f,\"parse_ns\":%.0f,\"parse_mb_per_s\":%.1f,\"union_ns\":%.0f,\"diff_ns\":%.0f,"
+		"\"lookup_ns\":%.1f,\"batch_ns\":%.1f,\"batch_sorted_ns\":%.1f,"
+		"\"freeze_ns\":%.0f,\"frozen_lookup_ns\":%.1f,\"heap_bytes\":%ld,\"frozen_bytes\":%zu}\n",
+		kFormatVersion,gen_name.c_str(),keylen,n,
+		x.GetRangeNum(),u.GetRangeNum(),d.GetRangeNum(),kv.size(),found,
+		build_ns,parse_ns,spec.size()*1e3/parse_ns,union_ns,diff_ns,
+		lookup_ns,batch_ns,batch_sorted_ns,
+		freeze_ns,frozen_lookup_ns,heap1-heap0,frz.MemoryUsage());
+	fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+	string usage="Usage: text_range_bench [-m min_ranges] [-n max_ranges] [-q queries] [-g random|disjoint|prefix|nested] [-l key_len[,key_len...]]\n";
+	Options opt;
+
+	int c;
+	while((c=getopt(argc,argv,"hm:n:q:g:l:"))!=-1) {
+		switch(c) {
+			case 'm':
+				opt.min_ranges=max(1ULL,strtoull(optarg,NULL,10));
+				break;
+			case 'n':
+				opt.max_ranges=strtoull(optarg,NULL,10);
+				break;
+			case 'q':
+				opt.queries=max(1ULL,strtoull(optarg,NULL,10));
+				break;
+			case 'g':
+				opt.generator=optarg;
+				break;
+			case 'l': {
+				opt.keylens.clear();
+				char* p=optarg;
+				while(*p) {
+					opt.keylens.push_back(max(1UL,strtoul(p,&p,10)));
+					if(*p==',')
+						p++;
+					else if(*p)
+						break;
+				}
+				break;
+			}
+			case 'h':
+				cout<<usage;
+				return 0;
+			default:
+				cerr<<usage;
+				return 1;
+		}
+	}
+
+	const char* generators[]={"random","disjoint","prefix","nested"};
+	if(!opt.generator.empty() && find(begin(generators),end(generators),opt.generator)==end(generators)) {
+		cerr<<"Error: unknown generator "<<opt.generator<<endl<<usage;
+		return 1;
+	}
+	for(const char* g:generators) {
+		if(!opt.generator.empty() && opt.generator!=g)
+			continue;
+		for(size_t keylen:opt.keylens) {
+			for(size_t n=opt.min_ranges;n<=opt.max_ranges;n*=10)
+				Run(opt,g,keylen,n);
+		}
+	}
+	return 0;
+}
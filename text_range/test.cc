@@ -1,4 +1,7 @@
 #include "TextRange.h"
+#include "FrozenTextRange.h"
+#include "ConcurrentTextRange.h"
+#include <thread>
 
 int main() {
 	cout<<"---------- Query -------"<<endl;
@@ -10,6 +13,10 @@ int main() {
 		cout<<r<<" is in range."<<endl;
 	else
 		cout<<r<<" is NOT in range."<<endl;
+	vector<string_view> keys={"AaA","Aaab","B","BaB","Ab"};
+	vector<bool> found=rng.BatchInRange(keys);
+	for(size_t i=0;i<keys.size();++i)
+		cout<<keys[i]<<(found[i] ? " is in range." : " is NOT in range.")<<endl;
 
 	cout<<"--------- Addition --------"<<endl;
 	TextRange rng1("[AaA-BaB]");
@@ -21,8 +28,55 @@ int main() {
 	rng33+=rng22;
 	cout<<rng3.ToString()<<" + "<<rng22.ToString()<<" = "<<rng33.ToString()<<endl;
 
+	vector<Range> list={Range("[Dd-Df]"),Range("[AaA-BaB]"),Range("(Aac-CaC)"),Range("Dc")};
+	TextRange rng44(list);
+	cout<<"Built from a list: "<<rng44.ToString()<<endl;
+	TextRange self(rng44);
+	self+=self;
+	cout<<rng44.ToString()<<" + itself = "<<self.ToString()<<endl;
+
 	cout<<"-------- Substraction---------"<<endl;
 	TextRange rng4("[Aaab-BaB]");
 	TextRange rng5=rng3-rng4;
 	cout<<rng3.ToString()<<" - "<<rng4.ToString()<<" = "<<rng5.ToString()<<endl;
+	self-=self;
+	cout<<rng44.ToString()<<" - itself = "<<self.ToString()<<endl;
+
+	cout<<"-------- Intersection---------"<<endl;
+	TextRange rng6("(BaB-Dda)");
+	TextRange rng7=rng33&rng6;
+	cout<<rng33.ToString()<<" & "<<rng6.ToString()<<" = "<<rng7.ToString()<<endl;
+
+	cout<<"-------- Frozen---------"<<endl;
+	FrozenTextRange frz(rng33);
+	frz.Save("ranges.ftr");
+	FrozenTextRange loaded=FrozenTextRange::Open("ranges.ftr");
+	cout<<"Frozen "<<loaded.Thaw().ToString()<<" in "<<loaded.MemoryUsage()<<" bytes"<<endl;
+	for(const char* key:{"Ab","Dd","Dda"})
+		cout<<key<<(loaded.InRange(key) ? " is in range." : " is NOT in range.")<<endl;
+
+	cout<<"-------- Concurrent---------"<<endl;
+	ConcurrentTextRange crng(rng33);
+	{
+		auto snap=crng.Snapshot();	// pins the current version
+		thread writer([&crng] {crng-=TextRange("[Dd-Df]");});
+		writer.join();
+		cout<<"Snapshot: "<<snap->ToString()<<endl;
+	}
+	cout<<"Updated: "<<crng.Load().ToString()<<endl;
+
+	cout<<"-------- Parse error---------"<<endl;
+	try {
+		TextRange bad("[AaA-BaB],(Dd-Df");
+	} catch(const TextRangeParseError& e) {
+		cout<<e.what()<<endl;
+	}
+
+	cout<<"-------- Numeric keys---------"<<endl;
+	typedef BasicTextRange<uint32_t> IdRange;
+	IdRange ids({IdRange::Range('[',100,200,')'),IdRange::Range('[',150,300,']')});
+	ids-=IdRange::Range('(',180,190,')');
+	cout<<"IDs: "<<ids.ToString()<<endl;
+	for(uint32_t id:{99u,180u,185u,300u})
+		cout<<id<<(ids.InRange(id) ? " is in range." : " is NOT in range.")<<endl;
 }